@@ -11,96 +11,9 @@
 // Shared data
 int shared_data = 0;
 
-// Reader-Writer synchronization state
-struct rwlock {
-    int readers_active;      // Number of readers currently reading
-    int writers_waiting;     // Number of writers waiting
-    int writer_active;       // 1 if a writer is writing, 0 otherwise
-    mutex_t lock;            // Protects the state variables
-    cond_t readers_ok;       // Condition for readers to proceed
-    cond_t writers_ok;       // Condition for writers to proceed
-};
-
-struct rwlock rwlock;
-
-// Initialize reader-writer lock
-void rwlock_init(struct rwlock *rw) {
-    rw->readers_active = 0;
-    rw->writers_waiting = 0;
-    rw->writer_active = 0;
-    mutex_init(&rw->lock);
-    cond_init(&rw->readers_ok);
-    cond_init(&rw->writers_ok);
-}
-
-// Acquire read lock
-void reader_lock(struct rwlock *rw) {
-    mutex_lock(&rw->lock);
-
-    // Wait if a writer is active or writers are waiting (writer priority)
-    while (rw->writer_active || rw->writers_waiting > 0) {
-        cond_wait(&rw->readers_ok, &rw->lock);
-    }
-
-    // Increment reader count
-    rw->readers_active++;
-
-    mutex_unlock(&rw->lock);
-}
-
-// Release read lock
-void reader_unlock(struct rwlock *rw) {
-    mutex_lock(&rw->lock);
-
-    // Decrement reader count
-    rw->readers_active--;
-
-    // If this was the last reader and writers are waiting, wake a writer
-    if (rw->readers_active == 0 && rw->writers_waiting > 0) {
-        cond_signal(&rw->writers_ok);
-    }
-
-    mutex_unlock(&rw->lock);
-}
-
-// Acquire write lock
-void writer_lock(struct rwlock *rw) {
-    mutex_lock(&rw->lock);
-
-    // Indicate that a writer is waiting
-    rw->writers_waiting++;
-
-    // Wait while readers are active or another writer is writing
-    while (rw->readers_active > 0 || rw->writer_active) {
-        cond_wait(&rw->writers_ok, &rw->lock);
-    }
-
-    // We're no longer waiting
-    rw->writers_waiting--;
-
-    // Mark writer as active
-    rw->writer_active = 1;
-
-    mutex_unlock(&rw->lock);
-}
-
-// Release write lock
-void writer_unlock(struct rwlock *rw) {
-    mutex_lock(&rw->lock);
-
-    // Mark writer as inactive
-    rw->writer_active = 0;
-
-    // If writers are waiting, wake one (writer priority)
-    if (rw->writers_waiting > 0) {
-        cond_signal(&rw->writers_ok);
-    } else {
-        // Otherwise, wake all readers
-        cond_broadcast(&rw->readers_ok);
-    }
-
-    mutex_unlock(&rw->lock);
-}
+// Reader-writer lock from the library. In RWLOCK_PREFER_WRITER mode new
+// readers wait while a writer is queued, so writers do not starve
+rwlock_t rwlock;
 
 // Reader thread function
 void* reader(void *arg) {
@@ -108,7 +21,7 @@ void* reader(void *arg) {
 
     for (int i = 0; i < READS_PER_READER; i++) {
         // Acquire read lock
-        reader_lock(&rwlock);
+        rwlock_rdlock(&rwlock);
 
         // Read the shared data
         int value = shared_data;
@@ -120,7 +33,7 @@ void* reader(void *arg) {
         }
 
         // Release read lock
-        reader_unlock(&rwlock);
+        rwlock_unlock(&rwlock);
 
         // Yield between operations
         thread_yield();
@@ -136,7 +49,7 @@ void* writer(void *arg) {
 
     for (int i = 0; i < WRITES_PER_WRITER; i++) {
         // Acquire write lock
-        writer_lock(&rwlock);
+        rwlock_wrlock(&rwlock);
 
         // Write new value to shared data
         shared_data++;
@@ -148,7 +61,7 @@ void* writer(void *arg) {
         }
 
         // Release write lock
-        writer_unlock(&rwlock);
+        rwlock_unlock(&rwlock);
 
         // Yield between operations
         thread_yield();
@@ -170,8 +83,8 @@ int main(void) {
     // Initialize threading system
     thread_init();
 
-    // Initialize reader-writer lock
-    rwlock_init(&rwlock);
+    // Initialize reader-writer lock with writer priority
+    rwlock_init_mode(&rwlock, RWLOCK_PREFER_WRITER);
 
     int reader_tids[NUM_READERS];
     int reader_args[NUM_READERS];
@@ -0,0 +1,145 @@
+// Kernel support for the user-level threading library (xv6 x86)
+// Copy into the xv6 directory and add uthreadsys.o to OBJS;
+// see Kernel.snippet for the remaining edits.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+
+// ===== Stack Guard Pages =====
+
+#define PTE_GUARD   0x200       // Software PTE bit: uthread stack guard page
+#define GUARD_MAGIC 0x75677264  // Marks a tagged guard page ("drgu")
+
+// Written at the start of each guard page so faults can name the thread
+struct guard_tag {
+  uint magic;
+  int tid;
+};
+
+// int guardpage(void *va, int tid)
+// tid >= 0: make the page at va inaccessible to user code and tag it with tid
+// tid < 0:  make it an ordinary user page again
+int
+sys_guardpage(void)
+{
+  struct proc *curproc = myproc();
+  char *va;
+  int tid;
+  pte_t *pte;
+
+  if(argint(0, (int*)&va) < 0 || argint(1, &tid) < 0)
+    return -1;
+  if((uint)va % PGSIZE != 0 || (uint)va >= curproc->sz)
+    return -1;
+  if((pte = walkpgdir(curproc->pgdir, va, 0)) == 0 || !(*pte & PTE_P))
+    return -1;
+
+  if(tid >= 0){
+    // The kernel can still write the page after PTE_U is cleared
+    struct guard_tag *tag = (struct guard_tag*)P2V(PTE_ADDR(*pte));
+    tag->magic = GUARD_MAGIC;
+    tag->tid = tid;
+    *pte = (*pte & ~PTE_U) | PTE_GUARD;
+  } else {
+    *pte = (*pte & ~PTE_GUARD) | PTE_U;
+  }
+
+  lcr3(V2P(curproc->pgdir));  // Flush the stale TLB entry
+  return 0;
+}
+
+// Called by trap() for a user page fault at va. If va is in a uthread
+// guard page, report which thread overflowed its stack and return 1.
+int
+guardfault(struct proc *p, uint va)
+{
+  pte_t *pte;
+  struct guard_tag *tag;
+
+  if(va >= p->sz)
+    return 0;
+  pte = walkpgdir(p->pgdir, (char*)PGROUNDDOWN(va), 0);
+  if(pte == 0 || (*pte & (PTE_P | PTE_GUARD)) != (PTE_P | PTE_GUARD))
+    return 0;
+  tag = (struct guard_tag*)P2V(PTE_ADDR(*pte));
+  if(tag->magic != GUARD_MAGIC)
+    return 0;
+
+  cprintf("pid %d %s: uthread %d stack overflow "
+          "(guard page 0x%x, addr 0x%x)--kill proc\n",
+          p->pid, p->name, tag->tid, PGROUNDDOWN(va), va);
+  return 1;
+}
+
+// ===== Timer Upcalls (preemption) =====
+
+// int sigalarm(int ticks, void (*handler)(void))
+// Every ticks timer ticks spent in user mode, push the interrupted %eip
+// onto the user stack and resume at handler. The handler returns with a
+// plain ret, so no sigreturn is needed. ticks == 0 turns the alarm off.
+int
+sys_sigalarm(void)
+{
+  struct proc *curproc = myproc();
+  int ticks, handler;
+
+  if(argint(0, &ticks) < 0 || argint(1, &handler) < 0)
+    return -1;
+  if(ticks < 0 || (ticks > 0 && (uint)handler >= curproc->sz))
+    return -1;
+
+  curproc->alarmticks = ticks;
+  curproc->alarmleft = ticks;
+  curproc->alarmhandler = (uint)handler;
+  return 0;
+}
+
+// Called by trap() on each timer interrupt that arrived from user mode
+void
+alarmtick(struct proc *p, struct trapframe *tf)
+{
+  uint sp;
+
+  if(p->alarmticks <= 0 || --p->alarmleft > 0)
+    return;
+  p->alarmleft = p->alarmticks;
+
+  // On the 64-bit fork, store tf->rip at tf->rsp - 136 instead: the
+  // x86-64 upcall expects the 128-byte red zone to be left untouched
+  sp = tf->esp - 4;
+  if(copyout(p->pgdir, sp, &tf->eip, 4) < 0)
+    return;  // No room on the user stack; try again next period
+  tf->esp = sp;
+  tf->eip = p->alarmhandler;
+}
+
+// ===== Split-Stack Limit Block (thread_attr_setsplit) =====
+
+#define TLS_SIZE 0x34           // Code built with -fsplit-stack reads %gs:0x30
+
+// int settls(void *base)
+// Point the process's %gs at base, where the threading library keeps
+// the running thread's stack limit. base == 0 clears %gs again.
+// The 64-bit fork has no segment bases: keep tlsbase the same way but
+// load it into MSR_FS_BASE in switchuvm (the limit is at %fs:0x70).
+int
+sys_settls(void)
+{
+  struct proc *curproc = myproc();
+  uint base;
+
+  if(argint(0, (int*)&base) < 0)
+    return -1;
+  if(base != 0 && (base + TLS_SIZE < base || base + TLS_SIZE > curproc->sz))
+    return -1;
+
+  curproc->tlsbase = base;
+  switchuvm(curproc);  // Rewrites this CPU's SEG_UTLS descriptor
+  curproc->tf->gs = base ? (SEG_UTLS << 3) | DPL_USER : 0;
+  return 0;
+}
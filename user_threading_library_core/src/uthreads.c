@@ -1,91 +1,670 @@
 // User-level threading library implementation for xv6
 // This file contains the core threading functionality
 
-// For xv6, we'll need to include appropriate headers
-// In actual xv6 integration, these would be xv6 headers
-// For now, using placeholder includes
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "uthreads.h"
+
+#if defined(__riscv)
+// xv6-riscv has no guardpage syscall (kernel/uthreadsys.c is x86-only),
+// so creating a guarded stack fails there
+static int guardpage(void *va, int tid) {
+    return -1;
+}
+
+// Nor does gcc support -fsplit-stack there
+static int settls(void *base) {
+    return -1;
+}
+#endif
 
 // Global thread table and state
-struct thread threads[MAX_THREADS];
+// Control blocks are allocated in cache-line-aligned chunks and never
+// freed, so pointers to them stay valid; the chunk directory doubles
+// when full. Unused control blocks are T_UNUSED.
+struct thread **thread_chunks = 0;
+static int chunk_count = 0;
+static int chunk_capacity = 0;
+int thread_table_size = 0;
 struct thread *current_thread = 0;
 int next_tid = 1;
 
+// thread_switch hardcodes the offset of sp
+_Static_assert(__builtin_offsetof(struct thread, sp) == 8,
+               "uthreads_swtch*.S expects struct thread.sp at offset 8");
+
+// Threads that are ready to run: one round-robin queue per priority
+// level, plus a bitmap with bit p set when run_queues[p] is non-empty
+static struct thread_queue run_queues[THREAD_PRIO_LEVELS];
+static uint run_bitmap = 0;
+
+// Threads in a timed wait, as a binary min-heap ordered by wakeup tick.
+// q is the wait queue the thread leaves if its deadline passes first
+// (0 for thread_sleep)
+struct timer {
+    struct thread *t;
+    struct thread_queue *q;
+};
+static struct timer *timer_heap = 0;
+static int timer_count = 0;
+static int timer_capacity = 0;
+
+// timer_index of a thread whose timed wait ran out before it was woken
+#define TIMER_EXPIRED (-2)
+
+// Preemption (thread_set_quantum)
+// The timer upcall only switches threads when preempt_count is 0, i.e.
+// outside the library's critical sections; otherwise it sets
+// preempt_pending and the switch happens when the section ends
+static volatile int preempt_count = 0;
+static volatile int preempt_pending = 0;
+
+static inline void preempt_disable(void) {
+    preempt_count++;
+}
+
+static inline void preempt_enable(void) {
+    if (--preempt_count == 0 && preempt_pending) {
+        preempt_pending = 0;
+        thread_yield();
+    }
+}
+
+// Thread cond_signal woke while we held the mutex it waits for; our next
+// mutex_unlock switches to it (cleared on any context switch)
+static struct thread *pending_handoff = 0;
+
+// MUTEX_PRIO_INHERIT mutexes that are currently locked, linked through
+// pi_next; an owner's inherited priority is recomputed from this list
+static struct mutex *pi_held = 0;
+
+// Lazy FPU switching (THREAD_ATTR_FPU)
+// The x87/SSE registers hold fpu_owner's state. They are only saved and
+// reloaded when a different FP thread is switched in, so integer-only
+// threads never pay for it
+static struct thread *fpu_owner = 0;
+static char main_fpu[FPU_STATE_SIZE] __attribute__((aligned(16)));
+static char fpu_initial[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+// Shared run stack (THREAD_ATTR_SHARED)
+// shared_owner's frames are the ones on the stack right now. Switching
+// to another shared thread goes through the copier, a context with its
+// own small stack that saves shared_owner's live stack and restores
+// copy_next's, since neither can be copied while running on it
+static char *shared_stack = 0;
+static struct thread *shared_owner = 0;
+static struct thread copier;
+static struct thread *copy_next = 0;
+
+// Thread-local storage keys: key k is slot k of every thread's tls array
+struct thread_key {
+    int used;
+    void (*destructor)(void*);
+};
+static struct thread_key thread_keys[THREAD_KEYS_MAX];
+
+// Big stack (call_on_big_stack), lent to one thread at a time
+static char *big_stack = 0;
+static struct thread *big_stack_owner = 0;
+static int big_stack_split = 0;  // Owner's THREAD_ATTR_SPLIT, lifted meanwhile
+static struct thread_queue big_stack_waiters;
+
+// Split stacks (THREAD_ATTR_SPLIT)
+// Code built with -fsplit-stack checks each new frame against a limit
+// kept at a fixed offset from the thread pointer: %gs:0x30 on i386,
+// %fs:0x70 on x86-64. split_tls is the block settls points the segment
+// register at; the limit in it is the running thread's
+static unsigned long split_tls[16];
+static int split_ready = 0;
+
+// Headroom kept free under a split thread's limit for code that does not
+// check it. gcc lets frames under 256 bytes dip below the limit unchecked,
+// so __morestack may start up to 256 bytes into the slack. On top of that
+// run __morestack's saved registers, uthread_morestack and the switch to
+// split_scratch, then a preempt_enable that may yield through
+// thread_schedule into the context switch; or instead a timer upcall that
+// yields. The allocator never runs here (see split_scratch). Summed from
+// gcc -fstack-usage that is about 520 bytes on i386 (the yield from
+// uthread_morestack) and 910 on x86-64 (an upcall skipping the red zone
+// and saving xmm0-15)
+#if defined(__x86_64__)
+#define SPLIT_STACK_SLACK 1024
+#else
+#define SPLIT_STACK_SLACK 768
+#endif
+
+// Stack that uthread_morestack and uthread_releasestack switch to before
+// calling stack_alloc/stack_release, so malloc, free and sbrk never run in
+// the slack of the segment being left. Only used with preemption off, so
+// one is enough; it also holds a timer upcall that arrives meanwhile
+#define SPLIT_SCRATCH_SIZE 4096
+static char split_scratch[SPLIT_SCRATCH_SIZE] __attribute__((aligned(16)));
+
+// Point the segment register at split_tls. Until this runs, -fsplit-stack
+// code reads its limit from wherever the register points and faults
+static int split_setup(void) {
+    if (!split_ready) {
+        if (settls(split_tls) < 0) {
+            return -1;
+        }
+        split_ready = 1;
+    }
+    return 0;
+}
+
+// Start of every stack segment of a THREAD_ATTR_SPLIT thread: the
+// segment to go back to when this one is popped (stack 0 in the first)
+struct stack_segment {
+    char *stack;
+    char *mem;
+    int size;
+};
+
+// Every aging_interval picks, the scheduler serves the lowest-priority
+// runnable thread instead, so no level starves (0 disables aging)
+static int aging_interval = THREAD_AGING_INTERVAL;
+static int picks_since_aging = 0;
+
+// Unused control blocks, linked through next
+static struct thread *free_threads = 0;
+
+// Released stacks kept for reuse, bucketed by size class (log2 of size)
+// Each cached stack stores its list node in its own lowest usable bytes
+struct cached_stack {
+    struct cached_stack *next;
+    int size;
+    int flags;               // THREAD_ATTR_GUARD if a guard page is still armed
+    char *mem;               // Start of the underlying allocation
+};
+static struct cached_stack *stack_cache[STACK_CACHE_BUCKETS];
+static int stack_cache_count = 0;
+static int stack_cache_max = STACK_CACHE_MAX;
+
 // Forward declarations
 static void thread_wrapper(void);
-static struct thread* find_runnable_thread(void);
+static void copier_main(void);
+static int shared_stack_attach(struct thread *t);
+static void shared_stack_detach(struct thread *t);
+static void split_set_limit(struct thread *t);
+static void split_segment_pop(struct thread *t);
+static int add_thread_chunk(void);
+static struct thread* find_free_thread(void);
+static struct thread* find_thread(int tid);
+static int stack_alloc(struct thread *t, int size, int flags);
+static void stack_release(struct thread *t);
+static void stack_free(char *mem, char *stack, int flags);
+static void queue_init(struct thread_queue *q);
+static void queue_push(struct thread_queue *q, struct thread *t);
+static struct thread* queue_pop(struct thread_queue *q);
+static void queue_remove(struct thread_queue *q, struct thread *t);
+static void runq_push(struct thread *t);
+static struct thread* runq_pop(void);
+static void thread_switch_to(struct thread *next);
+static void thread_run(struct thread *old, struct thread *next);
+static void coro_list_init(struct coro_list *l);
+static int coro_wake_one(struct coro_list *l);
+static void timer_expire(uint now);
+static void tls_destroy(struct thread *t);
+static void thread_wake(struct thread *t);
+static void pi_update(struct thread *t);
+static void pi_boost(struct thread *t);
+static void big_stack_release(void);
 
 // ===== Part 1.1: Thread Initialization and Management =====
 
 void thread_init(void) {
-    // Initialize all thread slots to T_UNUSED
-    for (int i = 0; i < MAX_THREADS; i++) {
-        threads[i].tid = 0;
-        threads[i].state = T_UNUSED;
-        threads[i].sp = 0;
-        threads[i].start_routine = 0;
-        threads[i].arg = 0;
-        threads[i].retval = 0;
-        threads[i].joined_tid = -1;
-    }
-
-    // Set up thread 0 as the main thread (already running)
-    threads[0].tid = 0;
-    threads[0].state = T_RUNNING;
-    threads[0].joined_tid = -1;
-    current_thread = &threads[0];
+    // Start with one chunk of control blocks
+    thread_chunks = 0;
+    chunk_count = 0;
+    chunk_capacity = 0;
+    thread_table_size = 0;
+    free_threads = 0;
+    add_thread_chunk();
+    for (int i = 0; i < THREAD_PRIO_LEVELS; i++) {
+        queue_init(&run_queues[i]);
+    }
+    run_bitmap = 0;
+    picks_since_aging = 0;
+    queue_init(&big_stack_waiters);
+    timer_count = 0;
+
+    for (int i = 0; i < STACK_CACHE_BUCKETS; i++) {
+        stack_cache[i] = 0;
+    }
+    stack_cache_count = 0;
+
+    // Set up thread 0 as the main thread (already running on the process stack)
+    struct thread *t = find_free_thread();
+    t->tid = 0;
+    t->state = T_RUNNING;
+    t->joined_tid = -1;
+    t->prio = PRIO_DEFAULT;
+    t->base_prio = PRIO_DEFAULT;
+    t->timer_index = -1;
+    t->blocked_on = 0;
+    current_thread = t;
     next_tid = 1;
+
+    // main is an FP user and its state is the one in the registers;
+    // new FP threads start from a copy of this state
+    t->flags = THREAD_ATTR_FPU;
+    fpu_owner = t;
+    uthread_fpu_save(fpu_initial);
+
+#ifdef UTHREAD_SPLIT_STACKS
+    // Programs built with -fsplit-stack check the limit from main onwards;
+    // 0 in split_tls never trips, so main keeps its ordinary stack
+    split_setup();
+#endif
 }
 
-int thread_create(void* (*start_routine)(void*), void *arg) {
-    // Find an unused thread slot
-    struct thread *t = 0;
-    for (int i = 0; i < MAX_THREADS; i++) {
-        if (threads[i].state == T_UNUSED) {
-            t = &threads[i];
-            break;
+// Allocate another chunk of unused, cache-line-aligned control blocks
+// Returns -1 if out of memory
+static int add_thread_chunk(void) {
+    if (chunk_count == chunk_capacity) {
+        int new_capacity = chunk_capacity ? chunk_capacity * 2 : 1;
+        struct thread **new_dir =
+            (struct thread**)malloc(new_capacity * sizeof(struct thread*));
+        if (new_dir == 0) {
+            return -1;
+        }
+        for (int i = 0; i < chunk_count; i++) {
+            new_dir[i] = thread_chunks[i];
+        }
+        if (thread_chunks) {
+            free(thread_chunks);
         }
+        thread_chunks = new_dir;
+        chunk_capacity = new_capacity;
     }
 
-    if (t == 0) {
-        return -1;  // No available thread slots
+    // malloc only guarantees 8-byte alignment, so over-allocate and round up
+    char *mem = (char*)malloc(THREADS_PER_CHUNK * sizeof(struct thread) + CACHE_LINE_SIZE);
+    if (mem == 0) {
+        return -1;
+    }
+    unsigned long addr = ((unsigned long)mem + CACHE_LINE_SIZE - 1) &
+                         ~(unsigned long)(CACHE_LINE_SIZE - 1);
+    struct thread *chunk = (struct thread*)addr;
+
+    // Push in reverse so the free list hands them out in address order
+    for (int i = THREADS_PER_CHUNK - 1; i >= 0; i--) {
+        chunk[i].tid = 0;
+        chunk[i].state = T_UNUSED;
+        chunk[i].sp = 0;
+        chunk[i].next = free_threads;
+        chunk[i].prev = 0;
+        chunk[i].joined_tid = -1;
+        chunk[i].prio = PRIO_DEFAULT;
+        chunk[i].base_prio = PRIO_DEFAULT;
+        chunk[i].wakeup = 0;
+        chunk[i].timer_index = -1;
+        chunk[i].stack = 0;
+        chunk[i].stack_size = 0;
+        chunk[i].stack_mem = 0;
+        chunk[i].flags = 0;
+        chunk[i].tls = 0;
+        chunk[i].start_routine = 0;
+        chunk[i].arg = 0;
+        free_threads = &chunk[i];
     }
 
-    // Initialize the thread structure
-    t->tid = next_tid++;
-    t->state = T_RUNNABLE;
-    t->start_routine = start_routine;
-    t->arg = arg;
-    t->retval = 0;
-    t->joined_tid = -1;
+    thread_chunks[chunk_count++] = chunk;
+    thread_table_size += THREADS_PER_CHUNK;
+    return 0;
+}
+
+// Take an unused control block off the free list, adding a chunk if
+// the list is empty. Returns 0 if out of memory
+static struct thread* find_free_thread(void) {
+    if (free_threads == 0 && add_thread_chunk() < 0) {
+        return 0;
+    }
+
+    struct thread *t = free_threads;
+    free_threads = t->next;
+    t->next = 0;
+    return t;
+}
+
+// Find a live thread by TID (0 if not found)
+static struct thread* find_thread(int tid) {
+    for (int c = 0; c < chunk_count; c++) {
+        struct thread *chunk = thread_chunks[c];
+        for (int i = 0; i < THREADS_PER_CHUNK; i++) {
+            if (chunk[i].tid == tid && chunk[i].state != T_UNUSED) {
+                return &chunk[i];
+            }
+        }
+    }
+    return 0;
+}
+
+// Size class of a stack: floor(log2(size)), clamped to the bucket range
+static int stack_bucket(int size) {
+    int b = 0;
+    while ((size >>= 1) != 0 && b < STACK_CACHE_BUCKETS - 1) {
+        b++;
+    }
+    return b;
+}
+
+// Give thread t a stack of exactly size bytes, reusing a cached one if
+// possible. With THREAD_ATTR_GUARD the stack starts on a page boundary
+// with a guard page tagged with t's TID directly below it.
+// Returns -1 if out of memory or the guard page cannot be armed
+static int stack_alloc(struct thread *t, int size, int flags) {
+    flags &= THREAD_ATTR_GUARD;  // The only flag that changes the stack itself
+
+    struct cached_stack **pp = &stack_cache[stack_bucket(size)];
+    for (; *pp; pp = &(*pp)->next) {
+        if ((*pp)->size == size && (*pp)->flags == flags) {
+            struct cached_stack *s = *pp;
+            *pp = s->next;
+            stack_cache_count--;
+
+            // Re-tag the guard page so an overflow reports the new owner
+            if (flags & THREAD_ATTR_GUARD) {
+                guardpage((char*)s - PAGE_SIZE, t->tid);
+            }
+            t->stack_mem = s->mem;
+            t->stack = (char*)s;
+            t->stack_size = size;
+            return 0;
+        }
+    }
 
-    // Set up the stack
-    // Stack grows downward, so sp starts at the top
-    // We need to set up the stack so that when thread_switch
-    // restores context, it will call thread_wrapper
+    if (!(flags & THREAD_ATTR_GUARD)) {
+        char *mem = (char*)malloc(size);
+        if (mem == 0) {
+            return -1;
+        }
+        t->stack_mem = mem;
+        t->stack = mem;
+        t->stack_size = size;
+        return 0;
+    }
+
+    // One extra page to reach a page boundary, one for the guard itself
+    char *mem = (char*)malloc(size + 2 * PAGE_SIZE);
+    if (mem == 0) {
+        return -1;
+    }
+    char *guard = (char*)(((unsigned long)mem + PAGE_SIZE - 1) &
+                          ~(unsigned long)(PAGE_SIZE - 1));
+    if (guardpage(guard, t->tid) < 0) {
+        free(mem);
+        return -1;
+    }
+    t->stack_mem = mem;
+    t->stack = guard + PAGE_SIZE;
+    t->stack_size = size;
+    return 0;
+}
+
+// Disarm a stack's guard page (if any) and give its memory back to umalloc
+static void stack_free(char *mem, char *stack, int flags) {
+    if (flags & THREAD_ATTR_GUARD) {
+        guardpage(stack - PAGE_SIZE, -1);
+    }
+    free(mem);
+}
+
+// Return a thread's stack to the cache, or free it if the cache is full
+// Guard pages stay armed while a stack is cached
+static void stack_release(struct thread *t) {
+    if (stack_cache_count >= stack_cache_max) {
+        stack_free(t->stack_mem, t->stack, t->flags);
+        return;
+    }
+
+    struct cached_stack *s = (struct cached_stack*)t->stack;
+    int b = stack_bucket(t->stack_size);
+    s->size = t->stack_size;
+    s->flags = t->flags & THREAD_ATTR_GUARD;
+    s->mem = t->stack_mem;
+    s->next = stack_cache[b];
+    stack_cache[b] = s;
+    stack_cache_count++;
+}
+
+void thread_set_stack_cache(int max_stacks) {
+    if (max_stacks < 0) {
+        max_stacks = 0;
+    }
+    preempt_disable();
+    stack_cache_max = max_stacks;
+
+    // Trim stacks above the new cap
+    for (int b = 0; b < STACK_CACHE_BUCKETS && stack_cache_count > stack_cache_max; b++) {
+        while (stack_cache[b] && stack_cache_count > stack_cache_max) {
+            struct cached_stack *s = stack_cache[b];
+            stack_cache[b] = s->next;
+            stack_cache_count--;
+            stack_free(s->mem, (char*)s, s->flags);
+        }
+    }
+    preempt_enable();
+}
+
+int thread_create(void* (*start_routine)(void*), void *arg) {
+    return thread_create_ex(0, start_routine, arg);
+}
 
-    // Initialize stack pointer to top of stack
-    char *sp = t->stack + STACK_SIZE;
+void thread_attr_init(thread_attr_t *attr) {
+    attr->stack_size = STACK_SIZE;
+    attr->flags = 0;
+    attr->prio = PRIO_DEFAULT;
+}
+
+int thread_attr_setstacksize(thread_attr_t *attr, int size) {
+    if (size < STACK_SIZE_MIN) {
+        return -1;
+    }
+    attr->stack_size = size;
+    return 0;
+}
+
+int thread_attr_setprio(thread_attr_t *attr, int prio) {
+    if (prio < PRIO_HIGHEST || prio > PRIO_LOWEST) {
+        return -1;
+    }
+    attr->prio = prio;
+    return 0;
+}
+
+void thread_attr_setguard(thread_attr_t *attr, int on) {
+    if (on) {
+        attr->flags |= THREAD_ATTR_GUARD;
+    } else {
+        attr->flags &= ~THREAD_ATTR_GUARD;
+    }
+}
 
+void thread_attr_setshared(thread_attr_t *attr, int on) {
+    if (on) {
+        attr->flags |= THREAD_ATTR_SHARED;
+    } else {
+        attr->flags &= ~THREAD_ATTR_SHARED;
+    }
+}
+
+void thread_attr_setsplit(thread_attr_t *attr, int on) {
+    if (on) {
+        attr->flags |= THREAD_ATTR_SPLIT;
+        attr->stack_size = SPLIT_SEGMENT_SIZE;
+    } else {
+        attr->flags &= ~THREAD_ATTR_SPLIT;
+    }
+}
+
+void thread_attr_setfpu(thread_attr_t *attr, int on) {
+    if (on) {
+        attr->flags |= THREAD_ATTR_FPU;
+    } else {
+        attr->flags &= ~THREAD_ATTR_FPU;
+    }
+}
+
+// Where an FP thread's saved x87/SSE state lives: just below the top of
+// its stack, or a static buffer for main
+static char* fpu_area(struct thread *t) {
+    if (t->stack == 0) {
+        return main_fpu;
+    }
+    unsigned long top = (unsigned long)(t->stack + t->stack_size);
+    return (char*)((top - FPU_STATE_SIZE) & ~15UL);
+}
+
+// Hand the FPU to next, saving the previous FP thread's state
+static void fpu_switch(struct thread *next) {
+    if (fpu_owner) {
+        uthread_fpu_save(fpu_area(fpu_owner));
+    }
+    uthread_fpu_restore(fpu_area(next));
+    fpu_owner = next;
+}
+
+// Build the frame thread_switch expects on a fresh stack, so the first
+// switch to t "returns" into entry
+// Stack grows downward, so sp starts at the top
+static void thread_init_stack(struct thread *t, void (*entry)(void)) {
+    char *sp = t->stack + t->stack_size;
+
+    // FP threads start from a clean FP state saved at the stack top
+    if (t->flags & THREAD_ATTR_FPU) {
+        sp = fpu_area(t);
+        memmove(sp, fpu_initial, FPU_STATE_SIZE);
+    }
+
+#if defined(__riscv)
+    // thread_switch restores ra and s0-s11 from a 112-byte block and
+    // returns through ra; sp must stay 16-byte aligned
+    sp = (char*)((unsigned long)sp & ~15UL);
+    sp -= 14 * sizeof(void*);
+    for (int i = 0; i < 14; i++) {
+        ((void**)sp)[i] = 0;  // s0 (frame pointer) starts out null
+    }
+    ((void**)sp)[0] = (void*)entry;  // Restored into ra
+#elif defined(__x86_64__)
+    // SysV: at function entry (%rsp + 8) must be 16-byte aligned. Align
+    // the top, then leave a zero slot where thread_wrapper's own return
+    // address would be (entry never returns)
+    sp = (char*)((unsigned long)sp & ~15UL);
+    sp -= sizeof(void*);
+    *((void**)sp) = 0;
+
+    // Push thread_wrapper address (return address for thread_switch)
+    sp -= sizeof(void*);
+    *((void**)sp) = (void*)entry;
+
+    // Reserve space for saved registers: rbp, rbx, r12, r13, r14, r15
+    sp -= 6 * sizeof(void*);
+#else
     // Push thread_wrapper address (return address for thread_switch)
     sp -= sizeof(void*);
-    *((void**)sp) = (void*)thread_wrapper;
+    *((void**)sp) = (void*)entry;
 
     // Reserve space for saved registers (thread_switch will restore these)
     // x86 calling convention: we need to save ebp, ebx, esi, edi
     sp -= 4 * sizeof(void*);
+#endif
 
     // Save the stack pointer
     t->sp = (void*)sp;
+}
+
+int thread_create_ex(const thread_attr_t *attr, void* (*start_routine)(void*), void *arg) {
+    int stack_size = STACK_SIZE;
+    if (attr && attr->stack_size) {
+        stack_size = attr->stack_size;
+    }
+    int flags = attr ? attr->flags : 0;
+    if (flags & THREAD_ATTR_FPU) {
+        stack_size += FPU_STATE_SIZE;
+    }
+    if ((flags & THREAD_ATTR_SHARED) && (flags & (THREAD_ATTR_GUARD | THREAD_ATTR_FPU))) {
+        return -1;
+    }
+    if ((flags & THREAD_ATTR_SPLIT) &&
+        ((flags & (THREAD_ATTR_GUARD | THREAD_ATTR_FPU | THREAD_ATTR_SHARED)) ||
+         stack_size < 2 * SPLIT_STACK_SLACK)) {
+        return -1;
+    }
+    if (stack_size < STACK_SIZE_MIN) {
+        return -1;
+    }
+    // Round up to a multiple of 16 bytes
+    stack_size = (stack_size + 15) & ~15;
+
+    int prio = attr ? attr->prio : PRIO_DEFAULT;
+    if (prio < PRIO_HIGHEST || prio > PRIO_LOWEST) {
+        return -1;
+    }
+
+    preempt_disable();
+
+    // The first split thread sets up the limit block, unless thread_init did
+    if ((flags & THREAD_ATTR_SPLIT) && split_setup() < 0) {
+        preempt_enable();
+        return -1;
+    }
+
+    // Find an unused control block, growing the table if needed
+    struct thread *t = find_free_thread();
+    if (t == 0) {
+        preempt_enable();
+        return -1;  // Out of memory for the thread table
+    }
+    t->tid = next_tid++;
+
+    // Stacks are allocated separately from the control block
+    if ((flags & THREAD_ATTR_SHARED) ? shared_stack_attach(t) < 0 :
+                                        stack_alloc(t, stack_size, flags) < 0) {
+        t->tid = 0;
+        t->next = free_threads;
+        free_threads = t;
+        preempt_enable();
+        return -1;  // Out of memory for the stack
+    }
+
+    // Initialize the thread structure
+    t->flags = flags;
+    t->prio = prio;
+    t->base_prio = prio;
+    t->state = T_RUNNABLE;
+    t->start_routine = start_routine;  // Shares its slot with blocked_on
+    t->arg = arg;  // Shares its slot with retval
+    t->joined_tid = -1;
+
+    // Set up the stack so the first thread_switch lands in thread_wrapper
+    // (shared threads get their frame when they first take the stack)
+    if (!(flags & THREAD_ATTR_SHARED)) {
+        thread_init_stack(t, thread_wrapper);
+    }
+    if (flags & THREAD_ATTR_SPLIT) {
+        ((struct stack_segment*)t->stack)->stack = 0;  // First segment
+    }
 
-    return t->tid;
+    // Make the new thread eligible to run
+    runq_push(t);
+
+    int tid = t->tid;
+    preempt_enable();
+    return tid;
 }
 
 // Wrapper function that calls the thread's start_routine
 // and then calls thread_exit with the return value
 static void thread_wrapper(void) {
+    // We arrive here from thread_schedule, inside its critical section
+    preempt_count = 0;
+
     // Get the current thread's start_routine and arg
     void *(*start_routine)(void*) = current_thread->start_routine;
     void *arg = current_thread->arg;
+    current_thread->blocked_on = 0;
 
     // Call the thread's function
     void *retval = start_routine(arg);
@@ -95,16 +674,12 @@ static void thread_wrapper(void) {
 }
 
 void *thread_join(int tid) {
-    // Find the thread with the given tid
-    struct thread *t = 0;
-    for (int i = 0; i < MAX_THREADS; i++) {
-        if (threads[i].tid == tid && threads[i].state != T_UNUSED) {
-            t = &threads[i];
-            break;
-        }
-    }
+    preempt_disable();
 
+    // Find the thread with the given tid
+    struct thread *t = find_thread(tid);
     if (t == 0) {
+        preempt_enable();
         return 0;  // Thread not found
     }
 
@@ -125,14 +700,48 @@ void *thread_join(int tid) {
     // Collect the return value
     void *retval = t->retval;
 
-    // Clean up the thread slot
+    // Return the stack and control block for reuse by thread_create
+    if (fpu_owner == t) {
+        fpu_owner = 0;  // Its saved state goes away with the stack
+    }
+    if (t->flags & THREAD_ATTR_SHARED) {
+        shared_stack_detach(t);
+    } else {
+        // A split thread may have exited deep in its chain of segments
+        while ((t->flags & THREAD_ATTR_SPLIT) &&
+               ((struct stack_segment*)t->stack)->stack) {
+            split_segment_pop(t);
+        }
+        stack_release(t);
+    }
+    t->stack = 0;
+    t->stack_mem = 0;
     t->state = T_UNUSED;
     t->tid = 0;
+    t->next = free_threads;
+    free_threads = t;
 
+    preempt_enable();
     return retval;
 }
 
 void thread_exit(void *retval) {
+    // Destructors are ordinary code: run them before the thread winds down
+    tls_destroy(current_thread);
+
+    // Never re-enabled: this thread does not run again
+    preempt_disable();
+    if (current_thread->tls) {
+        free(current_thread->tls);
+        current_thread->tls = 0;
+    }
+
+    // fn of call_on_big_stack exited instead of returning. Our frames on
+    // the big stack are dead once we switch away, so a waiter may have it
+    if (big_stack_owner == current_thread) {
+        big_stack_release();
+    }
+
     // Save the return value
     current_thread->retval = retval;
 
@@ -141,10 +750,13 @@ void thread_exit(void *retval) {
 
     // Wake up any thread that is waiting for this thread
     int my_tid = current_thread->tid;
-    for (int i = 0; i < MAX_THREADS; i++) {
-        if (threads[i].state == T_SLEEPING && threads[i].joined_tid == my_tid) {
-            threads[i].state = T_RUNNABLE;
-            threads[i].joined_tid = -1;
+    for (int c = 0; c < chunk_count; c++) {
+        struct thread *chunk = thread_chunks[c];
+        for (int i = 0; i < THREADS_PER_CHUNK; i++) {
+            if (chunk[i].state == T_SLEEPING && chunk[i].joined_tid == my_tid) {
+                chunk[i].joined_tid = -1;
+                thread_wake(&chunk[i]);
+            }
         }
     }
 
@@ -160,18 +772,611 @@ int thread_self(void) {
 }
 
 void thread_yield(void) {
+    preempt_disable();
+
     // Mark current thread as runnable (not sleeping)
     current_thread->state = T_RUNNABLE;
 
     // Call scheduler to run another thread
     thread_schedule();
+
+    preempt_enable();
+}
+
+int thread_yield_to(int tid) {
+    preempt_disable();
+    struct thread *t = find_thread(tid);
+    if (t == 0 || t->state != T_RUNNABLE) {
+        preempt_enable();
+        return -1;
+    }
+    thread_switch_to(t);
+    preempt_enable();
+    return 0;
+}
+
+// ===== Thread-Local Storage =====
+
+// Times thread_exit rescans for values set again by a destructor
+#define TLS_DESTRUCTOR_ROUNDS 4
+
+int thread_key_create(thread_key_t *key, void (*destructor)(void*)) {
+    preempt_disable();
+    for (int k = 0; k < THREAD_KEYS_MAX; k++) {
+        if (!thread_keys[k].used) {
+            thread_keys[k].used = 1;
+            thread_keys[k].destructor = destructor;
+            *key = k;
+            preempt_enable();
+            return 0;
+        }
+    }
+    preempt_enable();
+    return -1;  // All keys in use
+}
+
+int thread_key_delete(thread_key_t key) {
+    if ((uint)key >= THREAD_KEYS_MAX || !thread_keys[key].used) {
+        return -1;
+    }
+    preempt_disable();
+    thread_keys[key].used = 0;
+    thread_keys[key].destructor = 0;
+
+    // A recycled key must start out empty in every thread
+    for (int c = 0; c < chunk_count; c++) {
+        struct thread *chunk = thread_chunks[c];
+        for (int i = 0; i < THREADS_PER_CHUNK; i++) {
+            if (chunk[i].tls) {
+                chunk[i].tls[key] = 0;
+            }
+        }
+    }
+    preempt_enable();
+    return 0;
+}
+
+void *thread_getspecific(thread_key_t key) {
+    void **tls = current_thread->tls;
+    if (tls == 0 || (uint)key >= THREAD_KEYS_MAX) {
+        return 0;
+    }
+    return tls[key];
+}
+
+int thread_setspecific(thread_key_t key, const void *value) {
+    if ((uint)key >= THREAD_KEYS_MAX || !thread_keys[key].used) {
+        return -1;
+    }
+
+    // The slot array is allocated on the thread's first set
+    void **tls = current_thread->tls;
+    if (tls == 0) {
+        preempt_disable();
+        tls = (void**)malloc(THREAD_KEYS_MAX * sizeof(void*));
+        if (tls == 0) {
+            preempt_enable();
+            return -1;
+        }
+        memset(tls, 0, THREAD_KEYS_MAX * sizeof(void*));
+        current_thread->tls = tls;
+        preempt_enable();
+    }
+    tls[key] = (void*)value;
+    return 0;
+}
+
+// Call the destructors for t's non-zero values, clearing each slot first
+static void tls_destroy(struct thread *t) {
+    for (int round = 0; t->tls && round < TLS_DESTRUCTOR_ROUNDS; round++) {
+        int called = 0;
+        for (int k = 0; k < THREAD_KEYS_MAX; k++) {
+            void *value = t->tls[k];
+            if (value && thread_keys[k].destructor) {
+                t->tls[k] = 0;
+                thread_keys[k].destructor(value);
+                called = 1;
+            }
+        }
+        if (!called) {
+            break;
+        }
+    }
+}
+
+// ===== Shared Run Stack =====
+
+// Saved copy of a shared thread's live stack, kept in t->stack_mem
+struct stack_copy {
+    int capacity;            // Bytes available in data
+    char data[];
+};
+
+// Give a THREAD_ATTR_SHARED thread the shared stack, creating it (and
+// the copier context) on first use. Returns -1 if out of memory
+static int shared_stack_attach(struct thread *t) {
+    if (shared_stack == 0) {
+        char *stack = (char*)malloc(SHARED_STACK_SIZE);
+        char *copier_stack = (char*)malloc(STACK_SIZE);
+        if (stack == 0 || copier_stack == 0) {
+            if (stack) {
+                free(stack);
+            }
+            if (copier_stack) {
+                free(copier_stack);
+            }
+            return -1;
+        }
+        shared_stack = stack;
+        copier.tid = -1;
+        copier.stack = copier_stack;
+        copier.stack_mem = copier_stack;
+        copier.stack_size = STACK_SIZE;
+        thread_init_stack(&copier, copier_main);
+    }
+
+    t->stack = shared_stack;
+    t->stack_size = SHARED_STACK_SIZE;
+    t->stack_mem = 0;
+    t->sp = 0;  // No frame yet: built when the thread first takes the stack
+    return 0;
+}
+
+// Drop a finished shared thread's saved stack
+static void shared_stack_detach(struct thread *t) {
+    if (shared_owner == t) {
+        shared_owner = 0;
+    }
+    if (t->stack_mem) {
+        free(t->stack_mem);
+    }
+}
+
+// Copy the live part of t's stack (sp up to the top) out of the shared stack
+static void shared_save(struct thread *t) {
+    int live = shared_stack + SHARED_STACK_SIZE - (char*)t->sp;
+    struct stack_copy *c = (struct stack_copy*)t->stack_mem;
+
+    if (c == 0 || c->capacity < live) {
+        int capacity = (live + 63) & ~63;
+        struct stack_copy *bigger =
+            (struct stack_copy*)malloc(sizeof(struct stack_copy) + capacity);
+        if (bigger == 0) {
+            // Mid-switch there is no caller to report the failure to
+            static char msg[] = "uthreads: out of memory saving a shared stack\n";
+            write(2, msg, sizeof(msg) - 1);
+            kill(getpid());
+        }
+        if (c) {
+            free(c);
+        }
+        c = bigger;
+        c->capacity = capacity;
+        t->stack_mem = (char*)c;
+    }
+    memmove(c->data, t->sp, live);
+}
+
+// Copy t's saved stack back into place
+static void shared_restore(struct thread *t) {
+    int live = shared_stack + SHARED_STACK_SIZE - (char*)t->sp;
+    struct stack_copy *c = (struct stack_copy*)t->stack_mem;
+    memmove(t->sp, c->data, live);
+}
+
+// Body of the copier context. Each time a thread switches to it, move
+// shared_owner's frames off the shared stack and copy_next's back on,
+// then continue into copy_next
+static void copier_main(void) {
+    for (;;) {
+        struct thread *next = copy_next;
+
+        // A zombie's frames are dead, nothing to save
+        if (shared_owner && shared_owner->state != T_ZOMBIE) {
+            shared_save(shared_owner);
+        }
+        if (next->sp == 0) {
+            thread_init_stack(next, thread_wrapper);
+        } else {
+            shared_restore(next);
+        }
+        shared_owner = next;
+
+        thread_switch(&copier, next);
+    }
+}
+
+// ===== Split Stacks =====
+
+// Load the limit for t: just above the slack in its current segment,
+// or 0 (never reached) for threads with an ordinary stack
+static void split_set_limit(struct thread *t) {
+    unsigned long limit = 0;
+    if (t->flags & THREAD_ATTR_SPLIT) {
+        limit = (unsigned long)t->stack + sizeof(struct stack_segment) + SPLIT_STACK_SLACK;
+    }
+#if defined(__x86_64__)
+    asm volatile("movq %0, %%fs:0x70" : : "r"(limit) : "memory");
+#elif !defined(__riscv)
+    asm volatile("movl %0, %%gs:0x30" : : "r"(limit) : "memory");
+#endif
+}
+
+// Put t's current segment back in the stack cache and make the one
+// below it current again
+static void split_segment_pop(struct thread *t) {
+    struct stack_segment below = *(struct stack_segment*)t->stack;
+    stack_release(t);
+    t->stack = below.stack;
+    t->stack_mem = below.mem;
+    t->stack_size = below.size;
+}
+
+// Put the current thread on a new segment of *(int*)size bytes whose
+// header records the one below (runs on split_scratch)
+static void *split_segment_push(void *size) {
+    struct thread *t = current_thread;
+    struct stack_segment below = { t->stack, t->stack_mem, t->stack_size };
+    if (stack_alloc(t, *(int*)size, 0) < 0) {
+        // The function cannot run without its frame
+        static char msg[] = "uthreads: out of memory growing a split stack\n";
+        write(2, msg, sizeof(msg) - 1);
+        kill(getpid());
+    }
+    *(struct stack_segment*)t->stack = below;
+    return 0;
+}
+
+// split_segment_pop for the current thread (runs on split_scratch)
+static void *split_segment_leave(void *unused) {
+    split_segment_pop(current_thread);
+    return 0;
+}
+
+void *uthread_morestack(char *args, unsigned long argsize, unsigned long framesize) {
+    preempt_disable();
+    struct thread *t = current_thread;
+
+    // Each segment is at least twice the last, so even deep recursion
+    // needs only a few; popped segments wait in the stack cache
+    unsigned long need = sizeof(struct stack_segment) + SPLIT_STACK_SLACK +
+                         framesize + argsize + 64;
+    int size = t->stack_size * 2;
+    while ((unsigned long)size < need) {
+        size *= 2;
+    }
+    uthread_call_on_stack(split_segment_push, &size, split_scratch + SPLIT_SCRATCH_SIZE);
+    split_set_limit(t);
+
+    // The function finds its stack arguments just above its return address
+    char *sp = (char*)(((unsigned long)(t->stack + size) - argsize) & ~15UL);
+    memmove(sp, args, argsize);
+    preempt_enable();
+    return sp;
+}
+
+void uthread_releasestack(void) {
+    preempt_disable();
+    uthread_call_on_stack(split_segment_leave, 0, split_scratch + SPLIT_SCRATCH_SIZE);
+    split_set_limit(current_thread);
+    preempt_enable();
+}
+
+// ===== Big Stack Calls =====
+
+int call_on_big_stack(void *(*fn)(void*), void *arg, void **retval) {
+    preempt_disable();
+    struct thread *self = current_thread;
+
+    // Already on the big stack: just make the call
+    if (big_stack_owner == self) {
+        preempt_enable();
+        void *ret = fn(arg);
+        if (retval) {
+            *retval = ret;
+        }
+        return 0;
+    }
+
+    // A shared thread's frames must stay on the shared stack (shared_save)
+    if (self->flags & THREAD_ATTR_SHARED) {
+        preempt_enable();
+        return -1;
+    }
+    if (big_stack == 0 && (big_stack = (char*)malloc(BIG_STACK_SIZE)) == 0) {
+        preempt_enable();
+        return -1;
+    }
+
+    // Wait our turn; the stack holds the owner's frames even while it sleeps
+    while (big_stack_owner) {
+        queue_push(&big_stack_waiters, self);
+        self->state = T_SLEEPING;
+        thread_schedule();
+    }
+    big_stack_owner = self;
+
+    // The split-stack limit describes our own segment; lift it meanwhile
+    big_stack_split = self->flags & THREAD_ATTR_SPLIT;
+    self->flags &= ~THREAD_ATTR_SPLIT;
+    if (big_stack_split) {
+        split_set_limit(self);
+    }
+    preempt_enable();
+
+    void *ret = uthread_call_on_stack(fn, arg, big_stack + BIG_STACK_SIZE);
+
+    preempt_disable();
+    big_stack_release();
+    if (self->flags & THREAD_ATTR_SPLIT) {
+        split_set_limit(self);
+    }
+    preempt_enable();
+
+    if (retval) {
+        *retval = ret;
+    }
+    return 0;
+}
+
+// The owner is done with the big stack (or exits on it): give back its
+// split flag and pass the stack to the next waiter
+static void big_stack_release(void) {
+    big_stack_owner->flags |= big_stack_split;
+    big_stack_split = 0;
+    big_stack_owner = 0;
+    struct thread *next = queue_pop(&big_stack_waiters);
+    if (next) {
+        thread_wake(next);
+    }
+}
+
+// ===== Preemption =====
+
+void thread_preempt_disable(void) {
+    preempt_disable();
+}
+
+void thread_preempt_enable(void) {
+    preempt_enable();
+}
+
+// Called on every timer upcall (see uthread_upcall in uthreads_swtch.S)
+void uthread_preempt(void) {
+    if (preempt_count > 0) {
+        // Inside a critical section: switch when it ends
+        preempt_pending = 1;
+        return;
+    }
+    thread_yield();
+}
+
+int thread_set_quantum(int ticks) {
+    if (ticks < 0) {
+        return -1;
+    }
+    preempt_pending = 0;
+#if defined(__riscv)
+    // No sigalarm upcall on xv6-riscv (kernel/uthreadsys.c is x86-only)
+    return ticks ? -1 : 0;
+#else
+    return sigalarm(ticks, ticks ? uthread_upcall : 0);
+#endif
 }
 
 // ===== Part 1.3: Scheduler =====
 
+// Make a queue empty
+static void queue_init(struct thread_queue *q) {
+    q->head = 0;
+    q->tail = 0;
+}
+
+// Append a thread to the tail of a queue
+static void queue_push(struct thread_queue *q, struct thread *t) {
+    t->next = 0;
+    t->prev = q->tail;
+    if (q->tail) {
+        q->tail->next = t;
+    } else {
+        q->head = t;
+    }
+    q->tail = t;
+}
+
+// Insert a thread at the head of a queue
+static void queue_push_head(struct thread_queue *q, struct thread *t) {
+    t->prev = 0;
+    t->next = q->head;
+    if (q->head) {
+        q->head->prev = t;
+    } else {
+        q->tail = t;
+    }
+    q->head = t;
+}
+
+// Remove and return the thread at the head of a queue (0 if empty)
+static struct thread* queue_pop(struct thread_queue *q) {
+    struct thread *t = q->head;
+    if (t == 0) {
+        return 0;
+    }
+
+    q->head = t->next;
+    if (q->head) {
+        q->head->prev = 0;
+    } else {
+        q->tail = 0;
+    }
+    t->next = 0;
+    t->prev = 0;
+    return t;
+}
+
+// Unlink a thread from anywhere in a queue
+static void queue_remove(struct thread_queue *q, struct thread *t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        q->head = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    } else {
+        q->tail = t->prev;
+    }
+    t->next = 0;
+    t->prev = 0;
+}
+
+// Add a runnable thread to the tail of its priority level
+static void runq_push(struct thread *t) {
+    queue_push(&run_queues[t->prio], t);
+    run_bitmap |= 1u << t->prio;
+}
+
+// Remove a runnable thread from its priority level
+static void runq_remove(struct thread *t) {
+    queue_remove(&run_queues[t->prio], t);
+    if (run_queues[t->prio].head == 0) {
+        run_bitmap &= ~(1u << t->prio);
+    }
+}
+
+// Pick the next thread to run: the head of the highest-priority
+// non-empty level (lowest set bit), or of the lowest-priority level
+// when aging is due. Returns 0 if nothing is runnable
+static struct thread* runq_pop(void) {
+    if (run_bitmap == 0) {
+        return 0;
+    }
+
+    int p = __builtin_ctz(run_bitmap);
+    if (aging_interval > 0 && ++picks_since_aging >= aging_interval) {
+        picks_since_aging = 0;
+        p = 31 - __builtin_clz(run_bitmap);
+    }
+
+    struct thread *t = queue_pop(&run_queues[p]);
+    if (run_queues[p].head == 0) {
+        run_bitmap &= ~(1u << p);
+    }
+    return t;
+}
+
+// Add a runnable thread to the head of its priority level
+static void runq_push_head(struct thread *t) {
+    queue_push_head(&run_queues[t->prio], t);
+    run_bitmap |= 1u << t->prio;
+}
+
+// Make a blocked thread runnable again
+static void thread_wake(struct thread *t) {
+    t->state = T_RUNNABLE;
+    runq_push(t);
+}
+
+// Switch directly to runnable thread next. The caller, if it can still
+// run, goes to the head of its level so it resumes as soon as next
+// blocks or yields (like a synchronous IPC call)
+static void thread_switch_to(struct thread *next) {
+    struct thread *old = current_thread;
+    runq_remove(next);
+    if (old->state == T_RUNNING || old->state == T_RUNNABLE) {
+        old->state = T_RUNNABLE;
+        runq_push_head(old);
+    }
+    thread_run(old, next);
+}
+
+// Wake-and-switch: let a thread we just woke run on our time slice,
+// unless that would put it ahead of us against priority order
+static void thread_handoff(struct thread *t) {
+    if (t->state == T_RUNNABLE && t->prio <= current_thread->prio) {
+        thread_switch_to(t);
+    }
+}
+
+// Change t's effective priority. A queued thread moves to the tail of
+// its new level
+static void thread_set_effective_prio(struct thread *t, int prio) {
+    if (t->prio == prio) {
+        return;
+    }
+    if (t->state == T_RUNNABLE) {
+        runq_remove(t);
+        t->prio = prio;
+        runq_push(t);
+    } else {
+        t->prio = prio;
+    }
+}
+
+int thread_setprio(int tid, int prio) {
+    if (prio < PRIO_HIGHEST || prio > PRIO_LOWEST) {
+        return -1;
+    }
+    preempt_disable();
+    struct thread *t = (tid == current_thread->tid) ? current_thread : find_thread(tid);
+    if (t == 0) {
+        preempt_enable();
+        return -1;
+    }
+
+    // An inherited priority stays until the mutex is released; a blocked
+    // thread passes its new priority on to the owner it waits for. Only
+    // a sleeping thread has started, so only then is blocked_on not
+    // start_routine
+    t->base_prio = prio;
+    pi_update(t);
+    if (t->state == T_SLEEPING) {
+        pi_boost(t);
+    }
+    preempt_enable();
+    return 0;
+}
+
+int thread_getprio(int tid) {
+    preempt_disable();
+    struct thread *t = (tid == current_thread->tid) ? current_thread : find_thread(tid);
+    int prio = t ? t->prio : -1;
+    preempt_enable();
+    return prio;
+}
+
+void thread_set_aging(int interval) {
+    aging_interval = interval > 0 ? interval : 0;
+    picks_since_aging = 0;
+}
+
 void thread_schedule(void) {
     struct thread *old = current_thread;
-    struct thread *next = find_runnable_thread();
+
+    // A thread that can still run goes to the back of its level,
+    // which keeps round-robin order among threads of equal priority
+    if (old->state == T_RUNNING || old->state == T_RUNNABLE) {
+        old->state = T_RUNNABLE;
+        runq_push(old);
+    }
+
+    // Wake any sleepers whose time has come
+    if (timer_count > 0) {
+        timer_expire(uptime());
+    }
+
+    struct thread *next = runq_pop();
+
+    // Nothing can run until a timer fires: block the whole process in
+    // the kernel until the earliest deadline instead of spinning
+    while (next == 0 && timer_count > 0) {
+        int delay = (int)(timer_heap[0].t->wakeup - uptime());
+        if (delay > 0) {
+            sleep(delay);
+        }
+        timer_expire(uptime());
+        next = runq_pop();
+    }
 
     // If no runnable thread found, continue with current thread
     if (next == 0) {
@@ -179,81 +1384,363 @@ void thread_schedule(void) {
         // In a real system, this would be a panic
         return;
     }
-
-    // Update states
-    if (old->state == T_RUNNING) {
-        old->state = T_RUNNABLE;
-    }
     // If old thread is T_SLEEPING or T_ZOMBIE, keep that state
 
+    thread_run(old, next);
+}
+
+// Make next the running thread and switch to it
+static void thread_run(struct thread *old, struct thread *next) {
     next->state = T_RUNNING;
     current_thread = next;
+    pending_handoff = 0;
+
+    // Perform context switch
+    // The critical-section depth belongs to the thread, so restore ours
+    // when we are switched back in
+    if (old != next) {
+        if ((next->flags & THREAD_ATTR_FPU) && fpu_owner != next) {
+            fpu_switch(next);
+        }
+        if (split_ready) {
+            split_set_limit(next);
+        }
+        int depth = preempt_count;
+        if ((next->flags & THREAD_ATTR_SHARED) && shared_owner != next) {
+            // The shared stack holds someone else's frames: let the
+            // copier swap them for next's before next runs
+            copy_next = next;
+            thread_switch(old, &copier);
+        } else {
+            thread_switch(old, next);
+        }
+        preempt_count = depth;
+    }
+}
+
+// ===== Sleeping and Timers =====
+
+// Swap two heap entries, keeping their recorded positions in sync
+static void timer_swap(int i, int j) {
+    struct timer tmp = timer_heap[i];
+    timer_heap[i] = timer_heap[j];
+    timer_heap[j] = tmp;
+    timer_heap[i].t->timer_index = i;
+    timer_heap[j].t->timer_index = j;
+}
+
+// Tick comparison that survives uptime() wrapping
+static int timer_before(struct timer *a, struct timer *b) {
+    return (int)(a->t->wakeup - b->t->wakeup) < 0;
+}
+
+static void timer_sift_up(int i) {
+    while (i > 0 && timer_before(&timer_heap[i], &timer_heap[(i - 1) / 2])) {
+        timer_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void timer_sift_down(int i) {
+    for (;;) {
+        int smallest = i;
+        int l = 2 * i + 1;
+        int r = 2 * i + 2;
+        if (l < timer_count && timer_before(&timer_heap[l], &timer_heap[smallest])) {
+            smallest = l;
+        }
+        if (r < timer_count && timer_before(&timer_heap[r], &timer_heap[smallest])) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            return;
+        }
+        timer_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+// Arm a timer that wakes t at tick wakeup, taking it off wait queue q
+// (if not 0) should it still be waiting there
+// Returns -1 if the heap cannot grow
+static int timer_add(struct thread *t, uint wakeup, struct thread_queue *q) {
+    if (timer_count == timer_capacity) {
+        int new_capacity = timer_capacity ? timer_capacity * 2 : THREADS_PER_CHUNK;
+        struct timer *new_heap =
+            (struct timer*)malloc(new_capacity * sizeof(struct timer));
+        if (new_heap == 0) {
+            return -1;
+        }
+        for (int i = 0; i < timer_count; i++) {
+            new_heap[i] = timer_heap[i];
+        }
+        if (timer_heap) {
+            free(timer_heap);
+        }
+        timer_heap = new_heap;
+        timer_capacity = new_capacity;
+    }
+
+    t->wakeup = wakeup;
+    t->timer_index = timer_count;
+    timer_heap[timer_count].t = t;
+    timer_heap[timer_count].q = q;
+    timer_count++;
+    timer_sift_up(t->timer_index);
+    return 0;
+}
+
+// Disarm t's timer, if it has one
+static void timer_remove(struct thread *t) {
+    int i = t->timer_index;
+    if (i < 0) {
+        return;
+    }
+
+    t->timer_index = -1;
+    timer_count--;
+    if (i == timer_count) {
+        return;
+    }
+    timer_heap[i] = timer_heap[timer_count];
+    timer_heap[i].t->timer_index = i;
+    timer_sift_up(i);
+    timer_sift_down(timer_heap[i].t->timer_index);
+}
+
+// Wake every thread whose deadline is at or before now. A thread that
+// was already woken by its wait queue just loses the timer; one still
+// waiting leaves the queue and is marked TIMER_EXPIRED for timed_block
+static void timer_expire(uint now) {
+    while (timer_count > 0 && (int)(timer_heap[0].t->wakeup - now) <= 0) {
+        struct thread *t = timer_heap[0].t;
+        struct thread_queue *q = timer_heap[0].q;
+        timer_remove(t);
+        if (t->state == T_SLEEPING) {
+            if (q) {
+                queue_remove(q, t);
+                t->timer_index = TIMER_EXPIRED;
+            }
+            thread_wake(t);
+        }
+    }
+}
+
+void thread_sleep(int ticks) {
+    preempt_disable();
+
+    if (ticks <= 0 || timer_add(current_thread, uptime() + ticks, 0) < 0) {
+        // Nothing to wait for (or no memory for a timer): just yield
+        current_thread->state = T_RUNNABLE;
+    } else {
+        current_thread->state = T_SLEEPING;
+    }
+    thread_schedule();
+
+    preempt_enable();
+}
+
+// Sleep on wait queue q, which the current thread has already joined,
+// for at most ticks. Returns 0 if woken through the queue, or -1 (off the
+// queue again) if the deadline passed or no timer could be armed
+static int timed_block(struct thread_queue *q, int ticks) {
+    if (ticks <= 0 || timer_add(current_thread, uptime() + ticks, q) < 0) {
+        queue_remove(q, current_thread);
+        return -1;
+    }
+
+    current_thread->state = T_SLEEPING;
+    thread_schedule();
+
+    if (current_thread->timer_index == TIMER_EXPIRED) {
+        current_thread->timer_index = -1;
+        return -1;
+    }
+    timer_remove(current_thread);
+    return 0;
+}
+
+// ===== Part 2.1: Mutex Implementation =====
 
-    // Perform context switch
-    if (old != next) {
-        thread_switch(old, next);
+// Priority t is entitled to: its base priority, raised to that of the
+// most urgent thread waiting on a MUTEX_PRIO_INHERIT mutex it holds
+static int pi_prio(struct thread *t) {
+    int prio = t->base_prio;
+    for (struct mutex *m = pi_held; m; m = m->pi_next) {
+        if (m->owner_tid != t->tid) {
+            continue;
+        }
+        for (struct thread *w = m->waiters.head; w; w = w->next) {
+            if (w->prio < prio) {
+                prio = w->prio;
+            }
+        }
     }
+    return prio;
 }
 
-// Helper function: find next runnable thread using round-robin
-static struct thread* find_runnable_thread(void) {
-    // Start searching from the thread after current_thread
-    int start_idx = (current_thread - threads + 1) % MAX_THREADS;
+// Recompute t's effective priority after its waiters or base changed
+static void pi_update(struct thread *t) {
+    thread_set_effective_prio(t, pi_prio(t));
+}
 
-    // First pass: search from start_idx to end of array
-    for (int i = start_idx; i < MAX_THREADS; i++) {
-        if (threads[i].state == T_RUNNABLE) {
-            return &threads[i];
+// t has started and may be blocked on a MUTEX_PRIO_INHERIT mutex: raise
+// the owner to t's priority, and the owner of whatever that owner is
+// blocked on, and so on down the chain. Owners hold a mutex, so they have
+// started; the chain only goes on through owners that are asleep
+static void pi_boost(struct thread *t) {
+    while (t->blocked_on) {
+        struct mutex *m = t->blocked_on;
+        struct thread *owner = (m->owner_tid == current_thread->tid)
+                                   ? current_thread : find_thread(m->owner_tid);
+        if (owner == 0 || owner->prio <= t->prio) {
+            return;
         }
+        thread_set_effective_prio(owner, t->prio);
+        if (owner->state != T_SLEEPING) {
+            return;
+        }
+        t = owner;
+    }
+}
+
+// t waits on m from now on; a MUTEX_PRIO_INHERIT owner inherits its
+// priority. Called with t on m's wait queue
+static void pi_block(mutex_t *m, struct thread *t) {
+    if (m->mode == MUTEX_PRIO_INHERIT) {
+        t->blocked_on = m;
+        pi_boost(t);
     }
+}
 
-    // Second pass: wrap around from beginning to start_idx
-    for (int i = 0; i < start_idx; i++) {
-        if (threads[i].state == T_RUNNABLE) {
-            return &threads[i];
+// The most urgent waiter on m, taken off the queue (FIFO among equals)
+static struct thread* pi_pop_waiter(mutex_t *m) {
+    struct thread *best = m->waiters.head;
+    for (struct thread *w = best; w; w = w->next) {
+        if (w->prio < best->prio) {
+            best = w;
         }
     }
-
-    // If current thread is runnable, return it
-    if (current_thread->state == T_RUNNABLE) {
-        return current_thread;
+    if (best) {
+        queue_remove(&m->waiters, best);
+        best->blocked_on = 0;
     }
+    return best;
+}
 
-    // No runnable thread found
-    return 0;
+// m was just locked by a thread that was not waiting for it
+static void pi_track(mutex_t *m) {
+    if (m->mode == MUTEX_PRIO_INHERIT) {
+        m->pi_next = pi_held;
+        pi_held = m;
+    }
 }
 
-// ===== Part 2.1: Mutex Implementation =====
+static void pi_untrack(mutex_t *m) {
+    for (struct mutex **p = &pi_held; *p; p = &(*p)->pi_next) {
+        if (*p == m) {
+            *p = m->pi_next;
+            return;
+        }
+    }
+}
 
 void mutex_init(mutex_t *m) {
+    mutex_init_mode(m, MUTEX_NORMAL);
+}
+
+void mutex_init_mode(mutex_t *m, int mode) {
     m->locked = 0;
     m->owner_tid = -1;
-    m->wait_count = 0;
-    for (int i = 0; i < MAX_THREADS; i++) {
-        m->wait_queue[i] = -1;
-    }
+    queue_init(&m->waiters);
+    m->mode = mode;
+    m->barges = 0;
+    m->pi_next = 0;
 }
 
-void mutex_lock(mutex_t *m) {
+// Lock m, giving up at tick deadline if timed. Returns 0 once the lock is
+// ours, -1 on timeout
+static int mutex_acquire(mutex_t *m, int timed, uint deadline) {
+    preempt_disable();
+
     // Try to acquire the lock
+    int woken = 0;
     while (m->locked) {
         // Lock is held by another thread, so block
 
-        // Add current thread to wait queue
-        m->wait_queue[m->wait_count++] = current_thread->tid;
-
-        // Block this thread
-        current_thread->state = T_SLEEPING;
+        // Add current thread to wait queue. A hybrid waiter that was
+        // woken and then beaten to the lock keeps its place at the head
+        if (woken && m->mode == MUTEX_HYBRID) {
+            queue_push_head(&m->waiters, current_thread);
+            m->barges++;
+        } else {
+            queue_push(&m->waiters, current_thread);
+        }
+        pi_block(m, current_thread);
+
+        // Block this thread and run another
+        if (timed) {
+            if (timed_block(&m->waiters, (int)(deadline - uptime())) < 0) {
+                // The owner no longer inherits our priority
+                if (current_thread->blocked_on) {
+                    current_thread->blocked_on = 0;
+                    struct thread *owner = find_thread(m->owner_tid);
+                    if (owner) {
+                        pi_update(owner);
+                    }
+                }
+                preempt_enable();
+                return -1;
+            }
+        } else {
+            current_thread->state = T_SLEEPING;
+            thread_schedule();
+        }
 
-        // Run another thread
-        thread_schedule();
+        // mutex_unlock may have handed us the lock directly
+        if (m->owner_tid == current_thread->tid) {
+            preempt_enable();
+            return 0;
+        }
 
         // When we wake up, try again
+        woken = 1;
     }
 
     // Acquire the lock
     m->locked = 1;
     m->owner_tid = current_thread->tid;
+    if (woken) {
+        m->barges = 0;
+    }
+    pi_track(m);
+
+    preempt_enable();
+    return 0;
+}
+
+void mutex_lock(mutex_t *m) {
+    mutex_acquire(m, 0, 0);
+}
+
+int mutex_trylock(mutex_t *m) {
+    preempt_disable();
+    int ret = -1;
+    if (!m->locked) {
+        m->locked = 1;
+        m->owner_tid = current_thread->tid;
+        pi_track(m);
+        ret = 0;
+    }
+    preempt_enable();
+    return ret;
+}
+
+int mutex_timedlock(mutex_t *m, int ticks) {
+    if (ticks <= 0) {
+        return mutex_trylock(m);
+    }
+    return mutex_acquire(m, 1, uptime() + ticks);
 }
 
 void mutex_unlock(mutex_t *m) {
@@ -263,49 +1750,76 @@ void mutex_unlock(mutex_t *m) {
         return;
     }
 
-    // Check if any threads are waiting
-    if (m->wait_count > 0) {
-        // Wake up the first waiting thread
-        int wake_tid = m->wait_queue[0];
+    preempt_disable();
 
-        // Remove from wait queue (shift all elements)
-        for (int i = 0; i < m->wait_count - 1; i++) {
-            m->wait_queue[i] = m->wait_queue[i + 1];
-        }
-        m->wait_count--;
+    // Wake up the first waiting thread, if any (the most urgent one
+    // under MUTEX_PRIO_INHERIT)
+    int pi = (m->mode == MUTEX_PRIO_INHERIT);
+    struct thread *t = pi ? pi_pop_waiter(m) : queue_pop(&m->waiters);
+    if (t) {
+        thread_wake(t);
+    }
 
-        // Find and wake the thread
-        for (int i = 0; i < MAX_THREADS; i++) {
-            if (threads[i].tid == wake_tid) {
-                threads[i].state = T_RUNNABLE;
-                break;
-            }
+    if (t && (m->mode == MUTEX_HANDOFF || pi ||
+              (m->mode == MUTEX_HYBRID && m->barges >= MUTEX_BARGE_LIMIT))) {
+        // Pass ownership straight to the waiter: the lock never looks
+        // free, so nobody can barge in before it runs
+        m->owner_tid = t->tid;
+        m->barges = 0;
+    } else {
+        // Release the lock
+        m->locked = 0;
+        m->owner_tid = -1;
+    }
+
+    // The new owner inherits the remaining waiters; we drop back to
+    // whatever the mutexes we still hold entitle us to
+    struct thread *owner = t;
+    if (pi) {
+        if (owner) {
+            pi_update(owner);
+        } else {
+            pi_untrack(m);
         }
+        pi_update(current_thread);
     }
 
-    // Release the lock
-    m->locked = 0;
-    m->owner_tid = -1;
+    // Now that the mutex is free, run the thread cond_signal woke for us.
+    // It waits on the mutex queue, so it is only runnable if it was the
+    // waiter we just woke
+    t = pending_handoff;
+    if (t) {
+        pending_handoff = 0;
+        thread_handoff(t);
+    }
+
+    // An inheriting mutex's new owner runs at once if it outranks us
+    if (pi && owner && owner->state == T_RUNNABLE &&
+        owner->prio < current_thread->prio) {
+        thread_switch_to(owner);
+    }
+
+    preempt_enable();
 }
 
 // ===== Part 2.3: Semaphore Implementation =====
 
 void sem_init(sem_t *s, int value) {
     s->count = value;
-    s->wait_count = 0;
-    for (int i = 0; i < MAX_THREADS; i++) {
-        s->wait_queue[i] = -1;
-    }
+    queue_init(&s->waiters);
+    coro_list_init(&s->coro_waiters);
 }
 
 void sem_wait(sem_t *s) {
+    preempt_disable();
+
     // Decrement the count
     s->count--;
 
     // If count is negative, block
-    while (s->count < 0) {
+    if (s->count < 0) {
         // Add current thread to wait queue
-        s->wait_queue[s->wait_count++] = current_thread->tid;
+        queue_push(&s->waiters, current_thread);
 
         // Block this thread
         current_thread->state = T_SLEEPING;
@@ -314,122 +1828,176 @@ void sem_wait(sem_t *s) {
         thread_schedule();
 
         // When we wake up, we've been granted access
-        break;
     }
+
+    preempt_enable();
+}
+
+int sem_trywait(sem_t *s) {
+    preempt_disable();
+    int ret = -1;
+    if (s->count > 0) {
+        s->count--;
+        ret = 0;
+    }
+    preempt_enable();
+    return ret;
+}
+
+int sem_timedwait(sem_t *s, int ticks) {
+    preempt_disable();
+
+    int ret = 0;
+    s->count--;
+    if (s->count < 0) {
+        queue_push(&s->waiters, current_thread);
+        if (timed_block(&s->waiters, ticks) < 0) {
+            // No longer waiting: give back the unit we claimed
+            s->count++;
+            ret = -1;
+        }
+    }
+
+    preempt_enable();
+    return ret;
 }
 
 void sem_post(sem_t *s) {
+    preempt_disable();
+
     // Increment the count
     s->count++;
 
     // If there were waiting threads (count was negative), wake one
-    if (s->wait_count > 0) {
-        // Wake up the first waiting thread
-        int wake_tid = s->wait_queue[0];
-
-        // Remove from wait queue
-        for (int i = 0; i < s->wait_count - 1; i++) {
-            s->wait_queue[i] = s->wait_queue[i + 1];
-        }
-        s->wait_count--;
-
-        // Find and wake the thread
-        for (int i = 0; i < MAX_THREADS; i++) {
-            if (threads[i].tid == wake_tid) {
-                threads[i].state = T_RUNNABLE;
-                break;
-            }
-        }
+    // and let it run right away
+    struct thread *t = queue_pop(&s->waiters);
+    if (t) {
+        thread_wake(t);
+        thread_handoff(t);
+    } else {
+        // Otherwise a parked coroutine retries its wait
+        coro_wake_one(&s->coro_waiters);
     }
+
+    preempt_enable();
 }
 
 // ===== Part 2.4: Condition Variable Implementation =====
 
 void cond_init(cond_t *c) {
-    c->wait_count = 0;
-    for (int i = 0; i < MAX_THREADS; i++) {
-        c->wait_queue[i] = -1;
-    }
+    queue_init(&c->waiters);
+    c->mutex = 0;
+    coro_list_init(&c->coro_waiters);
 }
 
-void cond_wait(cond_t *c, mutex_t *m) {
+// Wait on c, giving up after ticks if timed. The mutex is retaken either
+// way; returns -1 if the wait timed out
+static int cond_block(cond_t *c, mutex_t *m, int timed, int ticks) {
+    // Queueing, unlocking and sleeping must not be split by a preemption
+    preempt_disable();
+
     // Add current thread to wait queue
-    c->wait_queue[c->wait_count++] = current_thread->tid;
+    queue_push(&c->waiters, current_thread);
+    c->mutex = m;
 
-    // Release the mutex
+    // Release the mutex (we are about to sleep, so no handoff from here)
+    pending_handoff = 0;
     mutex_unlock(m);
 
-    // Block this thread
-    current_thread->state = T_SLEEPING;
+    // Block this thread and run another
+    int ret = 0;
+    if (timed) {
+        ret = timed_block(&c->waiters, ticks);
+    } else {
+        current_thread->state = T_SLEEPING;
+        thread_schedule();
+    }
 
-    // Run another thread
-    thread_schedule();
+    // When we wake up, re-acquire the mutex. If we were moved onto its
+    // wait queue, a handoff mutex is already ours
+    if (m->owner_tid != current_thread->tid) {
+        mutex_lock(m);
+    }
 
-    // When we wake up, re-acquire the mutex
-    mutex_lock(m);
+    preempt_enable();
+    return ret;
 }
 
-void cond_signal(cond_t *c) {
-    // If no threads are waiting, do nothing
-    if (c->wait_count == 0) {
-        return;
-    }
+void cond_wait(cond_t *c, mutex_t *m) {
+    cond_block(c, m, 0, 0);
+}
 
-    // Wake up the first waiting thread
-    int wake_tid = c->wait_queue[0];
+int cond_timedwait(cond_t *c, mutex_t *m, int ticks) {
+    return cond_block(c, m, 1, ticks);
+}
 
-    // Remove from wait queue
-    for (int i = 0; i < c->wait_count - 1; i++) {
-        c->wait_queue[i] = c->wait_queue[i + 1];
+// Wake a thread taken off a condition variable's queue. If the mutex it
+// must retake is held, it would only wake to block again in mutex_lock,
+// so move it straight onto the mutex's wait queue instead (wait morphing);
+// mutex_unlock then wakes it when it can actually get the lock. A timed
+// waiter has been signalled, so its timer goes. Returns 1 if the thread
+// is runnable now.
+static int cond_wake(cond_t *c, struct thread *t) {
+    if (c->mutex && c->mutex->locked) {
+        timer_remove(t);
+        queue_push(&c->mutex->waiters, t);
+        pi_block(c->mutex, t);
+        return 0;
     }
-    c->wait_count--;
+    thread_wake(t);
+    return 1;
+}
 
-    // Find and wake the thread
-    for (int i = 0; i < MAX_THREADS; i++) {
-        if (threads[i].tid == wake_tid) {
-            threads[i].state = T_RUNNABLE;
-            break;
+void cond_signal(cond_t *c) {
+    preempt_disable();
+
+    // Wake up the first waiting thread, if any, and let it run on our
+    // time slice. Its first step is retaking the mutex, so if we hold it
+    // the switch waits until we unlock
+    struct thread *t = queue_pop(&c->waiters);
+    if (t) {
+        if (cond_wake(c, t)) {
+            thread_handoff(t);
+        } else if (c->mutex->owner_tid == current_thread->tid) {
+            pending_handoff = t;
         }
+    } else {
+        coro_wake_one(&c->coro_waiters);
     }
+
+    preempt_enable();
 }
 
 void cond_broadcast(cond_t *c) {
-    // Wake up all waiting threads
-    while (c->wait_count > 0) {
-        int wake_tid = c->wait_queue[0];
-
-        // Remove from wait queue
-        for (int i = 0; i < c->wait_count - 1; i++) {
-            c->wait_queue[i] = c->wait_queue[i + 1];
-        }
-        c->wait_count--;
+    preempt_disable();
 
-        // Find and wake the thread
-        for (int i = 0; i < MAX_THREADS; i++) {
-            if (threads[i].tid == wake_tid) {
-                threads[i].state = T_RUNNABLE;
-                break;
-            }
-        }
+    // Wake up all waiting threads and coroutines. While the mutex is held
+    // the threads join its queue in order, and each wakes once it can lock
+    struct thread *t;
+    while ((t = queue_pop(&c->waiters)) != 0) {
+        cond_wake(c, t);
+    }
+    while (coro_wake_one(&c->coro_waiters)) {
     }
+
+    preempt_enable();
 }
 
 // ===== Part 2.5: Channel Implementation =====
 
-// Note: For xv6, we need malloc/free from umalloc.c
-// This is a placeholder - in actual xv6, you'd use the xv6 malloc
-
 channel_t* channel_create(int capacity) {
-    // In xv6, use malloc from umalloc.c
-    // For now, this is a placeholder
-    channel_t *ch = 0; // malloc(sizeof(channel_t));
+    if (capacity <= 0) {
+        return 0;
+    }
+
+    channel_t *ch = (channel_t*)malloc(sizeof(channel_t));
     if (ch == 0) {
         return 0;
     }
 
-    ch->buffer = 0; // malloc(capacity * sizeof(void*));
+    ch->buffer = (void**)malloc(capacity * sizeof(void*));
     if (ch->buffer == 0) {
-        // free(ch);
+        free(ch);
         return 0;
     }
 
@@ -446,6 +2014,27 @@ channel_t* channel_create(int capacity) {
     return ch;
 }
 
+// Add data to a channel that has room (ch->lock held)
+static void channel_put(channel_t *ch, void *data) {
+    ch->buffer[ch->write_pos] = data;
+    ch->write_pos = (ch->write_pos + 1) % ch->capacity;
+    ch->count++;
+
+    // Signal that data is available
+    cond_signal(&ch->not_empty);
+}
+
+// Remove the oldest item from a non-empty channel (ch->lock held)
+static void* channel_take(channel_t *ch) {
+    void *data = ch->buffer[ch->read_pos];
+    ch->read_pos = (ch->read_pos + 1) % ch->capacity;
+    ch->count--;
+
+    // Signal that space is available
+    cond_signal(&ch->not_full);
+    return data;
+}
+
 int channel_send(channel_t *ch, void *data) {
     mutex_lock(&ch->lock);
 
@@ -466,13 +2055,7 @@ int channel_send(channel_t *ch, void *data) {
         }
     }
 
-    // Add data to buffer
-    ch->buffer[ch->write_pos] = data;
-    ch->write_pos = (ch->write_pos + 1) % ch->capacity;
-    ch->count++;
-
-    // Signal that data is available
-    cond_signal(&ch->not_empty);
+    channel_put(ch, data);
 
     mutex_unlock(&ch->lock);
     return 0;
@@ -492,13 +2075,7 @@ int channel_recv(channel_t *ch, void **data) {
         cond_wait(&ch->not_empty, &ch->lock);
     }
 
-    // Retrieve data from buffer
-    *data = ch->buffer[ch->read_pos];
-    ch->read_pos = (ch->read_pos + 1) % ch->capacity;
-    ch->count--;
-
-    // Signal that space is available
-    cond_signal(&ch->not_full);
+    *data = channel_take(ch);
 
     mutex_unlock(&ch->lock);
     return 0;
@@ -515,3 +2092,329 @@ void channel_close(channel_t *ch) {
 
     mutex_unlock(&ch->lock);
 }
+
+// ===== Part 2.6: Reader-Writer Lock Implementation =====
+
+// rwlock state word
+#define RW_WRITER  0x1   // A writer holds the lock
+#define RW_WAITING 0x2   // Threads are queued: unlocking must hand the lock on
+#define RW_READER  0x4   // One active reader
+
+void rwlock_init(rwlock_t *rw) {
+    rwlock_init_mode(rw, RWLOCK_PREFER_WRITER);
+}
+
+void rwlock_init_mode(rwlock_t *rw, int mode) {
+    rw->state = 0;
+    rw->mode = mode;
+    queue_init(&rw->readers);
+    queue_init(&rw->writers);
+}
+
+// Hand the lock on to queued threads after a release. Woken threads
+// already hold the lock, so none of them wakes only to block again
+static void rwlock_wake(rwlock_t *rw) {
+    struct thread *t;
+    if (rw->writers.head &&
+        (rw->mode == RWLOCK_PREFER_WRITER || rw->readers.head == 0)) {
+        // A writer is next; the last active reader, if any, lets it in
+        if (rw->state < RW_READER) {
+            t = queue_pop(&rw->writers);
+            rw->state |= RW_WRITER;
+            thread_wake(t);
+        }
+    } else {
+        // Admit every queued reader at once
+        while ((t = queue_pop(&rw->readers)) != 0) {
+            rw->state += RW_READER;
+            thread_wake(t);
+        }
+    }
+    if (rw->readers.head == 0 && rw->writers.head == 0) {
+        rw->state &= ~RW_WAITING;
+    }
+}
+
+void rwlock_rdlock(rwlock_t *rw) {
+    preempt_disable();
+
+    // Fast path: no writer holds or waits for the lock
+    if ((rw->state & (RW_WRITER | RW_WAITING)) == 0) {
+        rw->state += RW_READER;
+        preempt_enable();
+        return;
+    }
+
+    if (!(rw->state & RW_WRITER) &&
+        (rw->mode == RWLOCK_PREFER_READER || rw->writers.head == 0)) {
+        rw->state += RW_READER;
+    } else {
+        // Sleep until rwlock_wake admits us with the next batch
+        queue_push(&rw->readers, current_thread);
+        rw->state |= RW_WAITING;
+        current_thread->state = T_SLEEPING;
+        thread_schedule();
+    }
+
+    preempt_enable();
+}
+
+void rwlock_wrlock(rwlock_t *rw) {
+    preempt_disable();
+
+    // Fast path: nobody holds or waits for the lock
+    if (rw->state == 0) {
+        rw->state = RW_WRITER;
+        preempt_enable();
+        return;
+    }
+
+    // Sleep until rwlock_wake hands us the lock
+    queue_push(&rw->writers, current_thread);
+    rw->state |= RW_WAITING;
+    current_thread->state = T_SLEEPING;
+    thread_schedule();
+
+    preempt_enable();
+}
+
+void rwlock_unlock(rwlock_t *rw) {
+    preempt_disable();
+
+    if (rw->state & RW_WRITER) {
+        rw->state &= ~RW_WRITER;
+    } else if (rw->state >= RW_READER) {
+        rw->state -= RW_READER;
+    }
+
+    // Fast path: nobody is queued
+    if (rw->state & RW_WAITING) {
+        rwlock_wake(rw);
+    }
+
+    preempt_enable();
+}
+
+// ===== Part 2.7: Barrier and Latch Implementation =====
+
+// Make every thread on q runnable in one pass
+static void queue_wake_all(struct thread_queue *q) {
+    struct thread *t = q->head;
+    queue_init(q);
+    while (t) {
+        struct thread *next = t->next;
+        thread_wake(t);
+        t = next;
+    }
+}
+
+void barrier_init(barrier_t *b, int count) {
+    b->count = count > 0 ? count : 1;
+    b->arrived = 0;
+    b->generation = 0;
+    queue_init(&b->waiters);
+}
+
+int barrier_wait(barrier_t *b) {
+    preempt_disable();
+
+    // Last to arrive: start the next generation and release the round
+    if (++b->arrived == b->count) {
+        b->arrived = 0;
+        b->generation++;
+        queue_wake_all(&b->waiters);
+        preempt_enable();
+        return BARRIER_SERIAL_THREAD;
+    }
+
+    // Only the end of our generation wakes us
+    uint generation = b->generation;
+    while (generation == b->generation) {
+        queue_push(&b->waiters, current_thread);
+        current_thread->state = T_SLEEPING;
+        thread_schedule();
+    }
+
+    preempt_enable();
+    return 0;
+}
+
+void latch_init(latch_t *l, int count) {
+    l->count = count > 0 ? count : 0;
+    queue_init(&l->waiters);
+}
+
+void latch_count_down(latch_t *l) {
+    preempt_disable();
+    if (l->count > 0 && --l->count == 0) {
+        queue_wake_all(&l->waiters);
+    }
+    preempt_enable();
+}
+
+void latch_wait(latch_t *l) {
+    preempt_disable();
+    while (l->count > 0) {
+        queue_push(&l->waiters, current_thread);
+        current_thread->state = T_SLEEPING;
+        thread_schedule();
+    }
+    preempt_enable();
+}
+
+// ===== Part 4: Stackless Coroutines =====
+
+static void coro_list_init(struct coro_list *l) {
+    l->head = 0;
+    l->tail = 0;
+}
+
+static void coro_list_push(struct coro_list *l, coro_t *co) {
+    co->next = 0;
+    if (l->tail) {
+        l->tail->next = co;
+    } else {
+        l->head = co;
+    }
+    l->tail = co;
+}
+
+static coro_t* coro_list_pop(struct coro_list *l) {
+    coro_t *co = l->head;
+    if (co) {
+        l->head = co->next;
+        if (l->head == 0) {
+            l->tail = 0;
+        }
+        co->next = 0;
+    }
+    return co;
+}
+
+// Queue a coroutine on its scheduler, waking the host thread if it is
+// waiting for work
+static void coro_ready(coro_t *co) {
+    coro_sched_t *s = co->sched;
+    co->state = T_RUNNABLE;
+    coro_list_push(&s->ready, co);
+    if (s->idle) {
+        s->idle = 0;
+        thread_wake(s->host);
+    }
+}
+
+// Make the oldest coroutine on a wait list ready to retry its operation
+// Returns 0 if the list was empty
+static int coro_wake_one(struct coro_list *l) {
+    coro_t *co = coro_list_pop(l);
+    if (co == 0) {
+        return 0;
+    }
+    coro_ready(co);
+    return 1;
+}
+
+// Block the running coroutine on a wait list
+static void coro_park(struct coro_list *l, coro_t *co) {
+    co->state = T_SLEEPING;
+    coro_list_push(l, co);
+}
+
+void coro_sched_init(coro_sched_t *s) {
+    coro_list_init(&s->ready);
+    s->live = 0;
+    s->host = 0;
+    s->idle = 0;
+}
+
+void coro_spawn(coro_sched_t *s, coro_t *co, coro_fn fn, void *arg) {
+    preempt_disable();
+    co->lc = 0;
+    co->fn = fn;
+    co->arg = arg;
+    co->sched = s;
+    s->live++;
+    coro_ready(co);
+    preempt_enable();
+}
+
+void coro_run(coro_sched_t *s) {
+    preempt_disable();
+    s->host = current_thread;
+
+    while (s->live > 0) {
+        coro_t *co = coro_list_pop(&s->ready);
+        if (co == 0) {
+            // Every coroutine is parked: sleep until one is woken
+            s->idle = 1;
+            current_thread->state = T_SLEEPING;
+            thread_schedule();
+            continue;
+        }
+
+        // Run the body outside the critical section so it can be preempted
+        co->state = T_RUNNING;
+        preempt_enable();
+        int r = co->fn(co);
+        preempt_disable();
+
+        if (r == CORO_DONE) {
+            co->state = T_ZOMBIE;
+            s->live--;
+        } else if (r == CORO_YIELDED) {
+            co->state = T_RUNNABLE;
+            coro_list_push(&s->ready, co);
+        }
+        // CORO_BLOCKED: already parked, and possibly woken again since
+    }
+
+    s->host = 0;
+    preempt_enable();
+}
+
+int coro_sem_wait(coro_t *co, sem_t *s) {
+    preempt_disable();
+    if (s->count > 0) {
+        s->count--;
+        preempt_enable();
+        return 0;
+    }
+    coro_park(&s->coro_waiters, co);
+    preempt_enable();
+    return CORO_WOULDBLOCK;
+}
+
+// The channel lock is only held for short, non-blocking sections, so
+// taking it may briefly block the host thread but never a coroutine
+
+int coro_chan_send(coro_t *co, channel_t *ch, void *data) {
+    mutex_lock(&ch->lock);
+    if (ch->closed) {
+        mutex_unlock(&ch->lock);
+        return -1;
+    }
+    if (ch->count == ch->capacity) {
+        coro_park(&ch->not_full.coro_waiters, co);
+        mutex_unlock(&ch->lock);
+        return CORO_WOULDBLOCK;
+    }
+    channel_put(ch, data);
+    mutex_unlock(&ch->lock);
+    return 0;
+}
+
+int coro_chan_recv(coro_t *co, channel_t *ch, void **data) {
+    mutex_lock(&ch->lock);
+    if (ch->count == 0) {
+        if (ch->closed) {
+            mutex_unlock(&ch->lock);
+            return -1;
+        }
+        coro_park(&ch->not_empty.coro_waiters, co);
+        mutex_unlock(&ch->lock);
+        return CORO_WOULDBLOCK;
+    }
+    *data = channel_take(ch);
+    mutex_unlock(&ch->lock);
+    return 0;
+}
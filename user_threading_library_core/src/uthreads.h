@@ -2,8 +2,24 @@
 #define UTHREADS_H
 
 // Configuration Constants
-#define MAX_THREADS 16
-#define STACK_SIZE 8192  // 8KB per thread stack
+#define THREADS_PER_CHUNK 16  // Thread table grows by this many control blocks
+#define STACK_SIZE 8192  // Default per-thread stack size (8KB)
+#define STACK_SIZE_MIN 512  // Smallest stack thread_create_ex accepts
+#define SHARED_STACK_SIZE 65536  // Run stack shared by THREAD_ATTR_SHARED threads
+#define SPLIT_SEGMENT_SIZE 2048  // First stack segment of a THREAD_ATTR_SPLIT thread
+#define BIG_STACK_SIZE 131072  // Stack call_on_big_stack runs functions on
+#define THREAD_KEYS_MAX 32  // Thread-local storage keys (thread_key_create)
+#define STACK_CACHE_MAX 16  // Default number of released stacks kept for reuse
+#define STACK_CACHE_BUCKETS 20  // Stack cache size classes (powers of two)
+#define CACHE_LINE_SIZE 64
+#define PAGE_SIZE 4096
+
+// Priorities (lower number = runs first)
+#define THREAD_PRIO_LEVELS 32
+#define PRIO_HIGHEST 0
+#define PRIO_DEFAULT 16
+#define PRIO_LOWEST (THREAD_PRIO_LEVELS - 1)
+#define THREAD_AGING_INTERVAL 16  // Default picks between starvation-avoidance picks
 
 // Thread States
 #define T_UNUSED   0  // Thread slot is available
@@ -12,20 +28,57 @@
 #define T_SLEEPING 3  // Thread is blocked (waiting on mutex/join)
 #define T_ZOMBIE   4  // Thread has finished but not yet joined
 
-// Thread Structure
+// Thread Structure (control block)
+// Fields the scheduler and wake paths touch come first; the stack lives
+// out of line so a control block fits in one cache line (on x86-64 the
+// hot fields still share the first line).
+// thread_switch (uthreads_swtch*.S) reads and writes sp at offset 8.
 struct thread {
     int tid;                    // Thread ID
     int state;                  // Thread state (T_UNUSED, T_RUNNABLE, etc.)
-    char stack[STACK_SIZE];     // Thread's stack
     void *sp;                   // Saved stack pointer
-    void *(*start_routine)(void*); // Starting function
-    void *arg;                  // Argument to start_routine
-    void *retval;               // Return value from thread
+    struct thread *next;        // Next thread in the queue this thread is on
+    struct thread *prev;        // Previous thread in the queue this thread is on
     int joined_tid;             // TID of thread waiting for this thread to finish
+    short prio;                 // Effective priority: base_prio, or higher if inherited
+    short base_prio;            // Priority set by thread_attr_setprio/thread_setprio
+    unsigned int wakeup;        // Tick at which a timed wait ends
+    int timer_index;            // Position in the timer heap (-1 if none)
+
+    // Cold fields: only used at create, exit and join
+    char *stack;                // Lowest address of the thread's stack (0 for main)
+    char *stack_mem;            // Allocation the stack was carved from
+    void **tls;                 // THREAD_KEYS_MAX thread-local slots (0 until first set)
+    union {
+        void *(*start_routine)(void*); // Starting function (until it starts)
+        struct mutex *blocked_on;   // MUTEX_PRIO_INHERIT mutex it waits for (once started)
+    };
+    union {
+        void *arg;              // Argument to start_routine (until it starts)
+        void *retval;           // Return value from thread (once it exits)
+    };
+    int stack_size;             // Size of the stack in bytes
+    int flags;                  // THREAD_ATTR_* options the thread was created with
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// Intrusive FIFO of threads, linked through struct thread's next/prev
+struct thread_queue {
+    struct thread *head;        // Oldest thread (dequeued first)
+    struct thread *tail;        // Newest thread
+};
+
+// FIFO of stackless coroutines (see Part 4), linked through coro.next
+struct coro;
+struct coro_list {
+    struct coro *head;
+    struct coro *tail;
 };
 
 // Global thread table and current thread pointer
-extern struct thread threads[MAX_THREADS];
+// Control blocks live in arrays of THREADS_PER_CHUNK; thread_table_size
+// counts every allocated control block
+extern struct thread **thread_chunks;
+extern int thread_table_size;
 extern struct thread *current_thread;
 extern int next_tid;
 
@@ -37,46 +90,200 @@ void thread_init(void);
 // Create a new thread
 int thread_create(void* (*start_routine)(void*), void *arg);
 
+// Thread attributes (for thread_create_ex)
+struct thread_attr {
+    int stack_size;          // Stack size in bytes (0 = STACK_SIZE)
+    int flags;               // THREAD_ATTR_* options
+    int prio;                // Initial priority (PRIO_DEFAULT)
+};
+
+// Thread attribute flags
+#define THREAD_ATTR_GUARD 0x1  // Put an inaccessible guard page below the stack
+#define THREAD_ATTR_FPU   0x2  // Thread uses x87/SSE: keep its FP state across switches
+#define THREAD_ATTR_SHARED 0x4 // Run on the shared stack, saving only the live part
+#define THREAD_ATTR_SPLIT 0x8  // Start on a small stack and chain segments on demand
+
+// fxsave area carved from the top of an FPU thread's stack
+#define FPU_STATE_SIZE 512
+
+typedef struct thread_attr thread_attr_t;
+
+// Set attributes to the defaults used by thread_create
+void thread_attr_init(thread_attr_t *attr);
+
+// Set the stack size (returns -1 if below STACK_SIZE_MIN)
+int thread_attr_setstacksize(thread_attr_t *attr, int size);
+
+// Set the initial priority (returns -1 if out of range)
+int thread_attr_setprio(thread_attr_t *attr, int prio);
+
+// Enable or disable a guard page under the stack (needs the guardpage
+// syscall; an overflow kills the process and the kernel reports the TID)
+void thread_attr_setguard(thread_attr_t *attr, int on);
+
+// Mark the thread as a floating-point user, so its x87/SSE state is saved
+// and restored when it shares the FPU with other such threads. Costs
+// FPU_STATE_SIZE bytes of stack; the main thread is always an FP user
+void thread_attr_setfpu(thread_attr_t *attr, int on);
+
+// Run the thread on one big stack shared with other such threads. When a
+// different shared thread needs the stack, the live part (sp to top) is
+// copied out to a right-sized buffer and copied back before it runs again.
+// Cheap for threads that sleep with shallow stacks; the thread must not
+// hand out pointers to its stack variables. Not combinable with guard/FPU
+void thread_attr_setshared(thread_attr_t *attr, int on);
+
+// Give the thread a growable stack. It starts with one SPLIT_SEGMENT_SIZE
+// segment (call thread_attr_setstacksize afterwards to start bigger), and
+// code compiled with gcc -fsplit-stack chains on a larger segment whenever
+// a frame would not fit. Needs the settls syscall (x86 only). Not
+// combinable with guard/FPU/shared.
+// The limit block is only set up by the first split thread_create_ex, so
+// -fsplit-stack code that runs before then (main included) must be marked
+// __attribute__((no_split_stack)), unless the library is built with
+// -DUTHREAD_SPLIT_STACKS to set it up in thread_init instead
+void thread_attr_setsplit(thread_attr_t *attr, int on);
+
+// Create a new thread with the given attributes (attr may be 0)
+int thread_create_ex(const thread_attr_t *attr, void* (*start_routine)(void*), void *arg);
+
 // Wait for a thread to terminate and get its return value
 void *thread_join(int tid);
 
+// Set how many joined threads' stacks are kept for reuse (0 disables caching)
+void thread_set_stack_cache(int max_stacks);
+
 // Terminate the currently running thread
 void thread_exit(void *retval) __attribute__((noreturn));
 
+// Run fn(arg) on a BIG_STACK_SIZE stack shared by all threads, then
+// continue on the caller's own stack; *retval (if not 0) gets fn's result.
+// One thread uses the big stack at a time: fn may yield or block, but
+// other callers wait until it returns, so fn must not wait for them.
+// Nested calls run fn directly, and fn may end the thread with
+// thread_exit, which frees the big stack. Returns -1 if the stack cannot
+// be allocated or the caller is a THREAD_ATTR_SHARED thread
+int call_on_big_stack(void *(*fn)(void*), void *arg, void **retval);
+
+// ===== Thread-Local Storage =====
+
+// A key names one slot in every thread; each thread sees its own value
+// (0 until it sets one). On thread_exit, the destructor (if any) is
+// called with each non-zero value
+typedef int thread_key_t;
+
+int thread_key_create(thread_key_t *key, void (*destructor)(void*));
+int thread_key_delete(thread_key_t key);    // Clears the slot in every thread
+void *thread_getspecific(thread_key_t key);
+int thread_setspecific(thread_key_t key, const void *value);
+
 // Get the TID of the currently running thread
 int thread_self(void);
 
 // Voluntarily yield the CPU to another thread
 void thread_yield(void);
 
+// Switch straight to runnable thread tid, ahead of the run queue order;
+// the caller resumes as soon as tid blocks or yields.
+// Returns -1 if tid is not runnable
+int thread_yield_to(int tid);
+
+// Block the calling thread for at least ticks timer ticks
+void thread_sleep(int ticks);
+
+// Change a thread's base priority, or read its effective priority, which
+// may be raised by MUTEX_PRIO_INHERIT (-1 if no such thread or bad priority)
+int thread_setprio(int tid, int prio);
+int thread_getprio(int tid);
+
+// Every interval scheduling decisions, run the lowest-priority runnable
+// thread instead of the highest so nothing starves (0 disables)
+void thread_set_aging(int interval);
+
 // Scheduler - selects next thread to run
 void thread_schedule(void);
 
 // Context switch (implemented in assembly)
 void thread_switch(struct thread *old, struct thread *next);
 
+// ===== Preemption =====
+
+// Switch threads every ticks timer ticks even if they never yield
+// (0 = cooperative only). Needs the sigalarm syscall (kernel/Kernel.snippet)
+int thread_set_quantum(int ticks);
+
+// Hold off preemption around code that is not thread-safe, e.g. calls to
+// malloc or printf that other threads may also be making. Calls nest.
+void thread_preempt_disable(void);
+void thread_preempt_enable(void);
+
+// Timer upcall entry (assembly) and the handler it calls
+void uthread_upcall(void);
+
+// Save/restore x87/SSE state (fxsave/fxrstor) to a 16-byte aligned
+// FPU_STATE_SIZE buffer (implemented in uthreads_swtch*.S)
+void uthread_fpu_save(void *area);
+void uthread_fpu_restore(void *area);
+void uthread_preempt(void);
+
+// Call fn(arg) with the stack pointer at top, then switch back
+// (implemented in uthreads_swtch*.S)
+void *uthread_call_on_stack(void *(*fn)(void*), void *arg, char *top);
+
+// Helpers for the split-stack entry __morestack (uthreads_swtch*.S):
+// switch the current thread to a new segment holding a copy of the
+// caller's stack arguments (returns the stack pointer to run on), and
+// drop that segment again once the function returns
+void *uthread_morestack(char *args, unsigned long argsize, unsigned long framesize);
+void uthread_releasestack(void);
+
 // ===== Part 2: Synchronization Primitives =====
 
+// Mutex modes (mutex_init_mode)
+#define MUTEX_NORMAL  0      // Unlock frees the lock; any thread may grab it first
+#define MUTEX_HANDOFF 1      // Unlock passes ownership straight to the head waiter
+#define MUTEX_HYBRID  2      // Like NORMAL, but hand off after MUTEX_BARGE_LIMIT barges
+#define MUTEX_PRIO_INHERIT 3 // Hand off to the most urgent waiter; the owner runs at
+                             // the priority of its most urgent waiter meanwhile
+
+// Aging (thread_set_aging, on by default) still runs the lowest-priority
+// runnable thread every THREAD_AGING_INTERVAL picks, ahead of an owner
+// running at an inherited priority. That only delays the owner by one
+// pick per interval, but callers that need strict priority inheritance
+// bounds should turn aging off with thread_set_aging(0)
+
+#define MUTEX_BARGE_LIMIT 4  // Times the head waiter may lose the lock in a row
+
 // Mutex structure
 struct mutex {
     int locked;              // 0 = unlocked, 1 = locked
     int owner_tid;           // TID of thread holding the lock
-    int wait_queue[MAX_THREADS]; // Queue of waiting thread TIDs
-    int wait_count;          // Number of threads waiting
+    struct thread_queue waiters; // Threads blocked on the lock (FIFO)
+    int mode;                // MUTEX_NORMAL, MUTEX_HANDOFF, MUTEX_HYBRID or MUTEX_PRIO_INHERIT
+    int barges;              // Times the head waiter was woken but beaten to the lock
+    struct mutex *pi_next;   // Next held MUTEX_PRIO_INHERIT mutex
 };
 
 typedef struct mutex mutex_t;
 
 // Mutex API
 void mutex_init(mutex_t *m);
+void mutex_init_mode(mutex_t *m, int mode);
 void mutex_lock(mutex_t *m);
 void mutex_unlock(mutex_t *m);
 
+// Non-blocking and bounded lock/wait variants: 0 on success, -1 if the
+// lock or unit was not available (try) or not obtained within ticks timer
+// ticks (timed). A timed-out waiter is taken off the wait queue.
+// cond_timedwait retakes the mutex before returning, even on timeout
+int mutex_trylock(mutex_t *m);
+int mutex_timedlock(mutex_t *m, int ticks);
+
 // Semaphore structure
 struct semaphore {
     int count;               // Semaphore count
-    int wait_queue[MAX_THREADS]; // Queue of waiting thread TIDs
-    int wait_count;          // Number of threads waiting
+    struct thread_queue waiters; // Threads blocked in sem_wait (FIFO)
+    struct coro_list coro_waiters; // Coroutines blocked in CORO_SEM_WAIT
 };
 
 typedef struct semaphore sem_t;
@@ -85,11 +292,14 @@ typedef struct semaphore sem_t;
 void sem_init(sem_t *s, int value);
 void sem_wait(sem_t *s);
 void sem_post(sem_t *s);
+int sem_trywait(sem_t *s);
+int sem_timedwait(sem_t *s, int ticks);
 
 // Condition Variable structure
 struct cond {
-    int wait_queue[MAX_THREADS]; // Queue of waiting thread TIDs
-    int wait_count;          // Number of threads waiting
+    struct thread_queue waiters; // Threads blocked in cond_wait (FIFO)
+    struct mutex *mutex;         // Mutex the waiters passed to cond_wait
+    struct coro_list coro_waiters; // Coroutines waiting on the same condition
 };
 
 typedef struct cond cond_t;
@@ -97,6 +307,7 @@ typedef struct cond cond_t;
 // Condition Variable API
 void cond_init(cond_t *c);
 void cond_wait(cond_t *c, mutex_t *m);
+int cond_timedwait(cond_t *c, mutex_t *m, int ticks);
 void cond_signal(cond_t *c);
 void cond_broadcast(cond_t *c);
 
@@ -121,4 +332,151 @@ int channel_send(channel_t *ch, void *data);
 int channel_recv(channel_t *ch, void **data);
 void channel_close(channel_t *ch);
 
+// Reader-writer lock modes
+#define RWLOCK_PREFER_WRITER 0  // New readers queue behind a waiting writer (default)
+#define RWLOCK_PREFER_READER 1  // New readers join active readers even if a writer waits
+
+// Reader-writer lock structure. state is a single word: a writer bit, a
+// "threads are queued" bit and the number of active readers, so the
+// uncontended lock and unlock paths only test and update that word
+struct rwlock {
+    int state;                   // RW_WRITER | RW_WAITING | readers * RW_READER
+    int mode;                    // RWLOCK_PREFER_WRITER or RWLOCK_PREFER_READER
+    struct thread_queue readers; // Readers blocked in rwlock_rdlock (FIFO)
+    struct thread_queue writers; // Writers blocked in rwlock_wrlock (FIFO)
+};
+
+typedef struct rwlock rwlock_t;
+
+// Reader-writer lock API. rwlock_unlock releases either kind of hold.
+// When a writer unlocks, every queued reader is admitted in one batch
+// (with RWLOCK_PREFER_WRITER only if no other writer is queued)
+void rwlock_init(rwlock_t *rw);
+void rwlock_init_mode(rwlock_t *rw, int mode);
+void rwlock_rdlock(rwlock_t *rw);
+void rwlock_wrlock(rwlock_t *rw);
+void rwlock_unlock(rwlock_t *rw);
+
+// Barrier structure (reusable: each round is one generation)
+struct barrier {
+    int count;                   // Threads that must arrive each round
+    int arrived;                 // Threads that have arrived this round
+    unsigned int generation;     // Rounds completed so far
+    struct thread_queue waiters; // Threads waiting for the round to complete
+};
+
+typedef struct barrier barrier_t;
+
+#define BARRIER_SERIAL_THREAD 1  // barrier_wait result for the last arrival
+
+// Barrier API. barrier_wait blocks until count threads have called it,
+// then returns BARRIER_SERIAL_THREAD in the last one to arrive and 0 in
+// the others; the barrier is then ready for the next round
+void barrier_init(barrier_t *b, int count);
+int barrier_wait(barrier_t *b);
+
+// Countdown latch structure (single use)
+struct latch {
+    int count;                   // Count downs still expected
+    struct thread_queue waiters; // Threads blocked in latch_wait
+};
+
+typedef struct latch latch_t;
+
+// Latch API. latch_wait blocks until latch_count_down has been called
+// count times; after that it returns at once
+void latch_init(latch_t *l, int count);
+void latch_count_down(latch_t *l);
+void latch_wait(latch_t *l);
+
+// ===== Part 4: Stackless Coroutines =====
+
+// Protothread-style tasks: a coroutine is a function that returns
+// whenever it would block and is called again later, resuming at the
+// CORO_* statement it stopped at. Coroutines have no stack, so local
+// variables do not survive a CORO_* statement; keep state in the struct
+// pointed to by arg. One host thread runs any number of them (coro_run).
+//
+//   int task(coro_t *co) {
+//       struct my_state *st = co->arg;
+//       CORO_BEGIN(co);
+//       CORO_SEM_WAIT(co, &st->ready);
+//       CORO_CHAN_SEND(co, st->out, st->value, st->ret);
+//       CORO_END(co);
+//   }
+
+// Values a coroutine body returns to coro_run
+#define CORO_BLOCKED 0       // Parked on a semaphore or channel
+#define CORO_YIELDED 1       // Still runnable, go to the back of the line
+#define CORO_DONE    2       // Finished
+
+// coro_sem_wait/coro_chan_* result: the coroutine was parked
+#define CORO_WOULDBLOCK 1
+
+struct coro_sched;
+typedef int (*coro_fn)(struct coro *co);
+
+// Coroutine (a few dozen bytes; embed it or allocate many at once)
+struct coro {
+    int lc;                  // Resume point (source line), 0 = start
+    int state;               // T_RUNNABLE, T_RUNNING, T_SLEEPING or T_ZOMBIE
+    coro_fn fn;              // Body
+    void *arg;               // Argument for the body
+    struct coro *next;       // Link in a ready or wait list
+    struct coro_sched *sched; // Scheduler that runs this coroutine
+};
+
+// Set of coroutines multiplexed onto one host thread
+struct coro_sched {
+    struct coro_list ready;  // Coroutines waiting for the host (FIFO)
+    int live;                // Spawned and not yet finished
+    struct thread *host;     // Thread inside coro_run (0 if none)
+    int idle;                // Host is asleep until a coroutine becomes ready
+};
+
+typedef struct coro coro_t;
+typedef struct coro_sched coro_sched_t;
+
+// Coroutine API
+void coro_sched_init(coro_sched_t *s);
+void coro_spawn(coro_sched_t *s, coro_t *co, coro_fn fn, void *arg);
+void coro_run(coro_sched_t *s);   // Run until every coroutine has finished
+
+// Blocking operations for use through the macros below. Each returns
+// CORO_WOULDBLOCK after parking co, otherwise 0 (or -1 if ch is closed)
+int coro_sem_wait(coro_t *co, sem_t *s);
+int coro_chan_send(coro_t *co, channel_t *ch, void *data);
+int coro_chan_recv(coro_t *co, channel_t *ch, void **data);
+
+#define CORO_BEGIN(co)  switch ((co)->lc) { case 0:
+
+#define CORO_END(co)    } (co)->lc = 0; return CORO_DONE
+
+// Let the other coroutines on this scheduler run
+#define CORO_YIELD(co) \
+    do { (co)->lc = __LINE__; return CORO_YIELDED; case __LINE__:; } while (0)
+
+// Block until cond is true (polled each time the coroutine is resumed)
+#define CORO_WAIT_UNTIL(co, cond) \
+    do { (co)->lc = __LINE__; case __LINE__: \
+         if (!(cond)) return CORO_YIELDED; } while (0)
+
+#define CORO_SEM_WAIT(co, s) \
+    do { (co)->lc = __LINE__; case __LINE__: \
+         if (coro_sem_wait((co), (s)) == CORO_WOULDBLOCK) return CORO_BLOCKED; \
+    } while (0)
+
+// ret gets 0, or -1 if the channel is closed
+#define CORO_CHAN_SEND(co, ch, data, ret) \
+    do { (co)->lc = __LINE__; case __LINE__: \
+         if (((ret) = coro_chan_send((co), (ch), (data))) == CORO_WOULDBLOCK) \
+             return CORO_BLOCKED; \
+    } while (0)
+
+#define CORO_CHAN_RECV(co, ch, datap, ret) \
+    do { (co)->lc = __LINE__; case __LINE__: \
+         if (((ret) = coro_chan_recv((co), (ch), (datap))) == CORO_WOULDBLOCK) \
+             return CORO_BLOCKED; \
+    } while (0)
+
 #endif // UTHREADS_H
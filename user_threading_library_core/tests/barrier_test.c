@@ -0,0 +1,80 @@
+// Barrier and latch test - workers run several phases separated by one
+// reused barrier, so no worker starts a phase before all have finished the
+// previous one; a latch tells main when every worker is done
+
+#include "../src/uthreads.h"
+
+#define NUM_WORKERS 5
+#define PHASES 4
+
+barrier_t barrier;
+latch_t done;
+
+// Workers that finished each phase, checked after every barrier
+int finished[PHASES];
+int early = 0;
+
+// Number of barrier_wait calls that returned BARRIER_SERIAL_THREAD
+int serial = 0;
+
+void* worker(void *arg) {
+    int id = (int)(long)arg;
+
+    for (int p = 0; p < PHASES; p++) {
+        // Uneven amounts of work per phase
+        for (int i = 0; i < (id + p) % 3; i++) {
+            thread_yield();
+        }
+        finished[p]++;
+
+        if (barrier_wait(&barrier) == BARRIER_SERIAL_THREAD) {
+            serial++;
+        }
+        if (finished[p] != NUM_WORKERS) {
+            early++;
+        }
+    }
+
+    latch_count_down(&done);
+    return 0;
+}
+
+int main(void) {
+    printf("Barrier and Latch Test\n");
+    printf("======================\n\n");
+
+    thread_init();
+    barrier_init(&barrier, NUM_WORKERS);
+    latch_init(&done, NUM_WORKERS);
+
+    int tids[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        tids[i] = thread_create(worker, (void*)(long)i);
+    }
+
+    // Every worker has counted down once the latch opens
+    latch_wait(&done);
+    int all_done = 1;
+    for (int p = 0; p < PHASES; p++) {
+        if (finished[p] != NUM_WORKERS) {
+            all_done = 0;
+        }
+    }
+    latch_wait(&done);  // An open latch does not block
+
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        thread_join(tids[i]);
+    }
+
+    printf("Phases: %d, left a barrier early: %d, serial threads: %d\n",
+           PHASES, early, serial);
+    printf("All phases finished when the latch opened: %s\n", all_done ? "yes" : "no");
+
+    if (early == 0 && serial == PHASES && all_done) {
+        printf("SUCCESS! Barrier and latch synchronized the workers.\n");
+    } else {
+        printf("FAILURE! Workers were not kept in step.\n");
+    }
+
+    exit();
+}
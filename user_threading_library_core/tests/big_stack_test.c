@@ -0,0 +1,128 @@
+// Big-stack test - threads with 1KB stacks run deep recursion through
+// call_on_big_stack, yielding while on it, and take turns using it; a
+// thread that exits while on the big stack hands it on
+
+#include "../src/uthreads.h"
+
+#define NUM_THREADS 4
+#define SMALL_STACK 1024
+#define DEPTH 500
+#define CALLS 3
+
+// Threads inside call_on_big_stack right now, and the most seen at once
+int on_big_stack = 0;
+int max_on_big_stack = 0;
+
+// Number of corrupted stack frames seen on the way back up
+int corrupted = 0;
+
+// Recurse with a frame full of a thread-specific pattern (~100KB in
+// all), yielding now and then so the other threads try to get in
+int recurse(int id, int depth) {
+    char frame[160];
+    for (int i = 0; i < sizeof(frame); i++) {
+        frame[i] = (char)(id * 31 + depth * 7 + i);
+    }
+
+    if (depth % 100 == 0) {
+        thread_yield();
+    }
+    int sum = id;
+    if (depth > 0) {
+        sum += recurse(id, depth - 1);
+    }
+
+    for (int i = 0; i < sizeof(frame); i++) {
+        if (frame[i] != (char)(id * 31 + depth * 7 + i)) {
+            corrupted++;
+            break;
+        }
+    }
+    return sum;
+}
+
+void* deep(void *arg) {
+    int id = (int)(long)arg;
+
+    on_big_stack++;
+    if (on_big_stack > max_on_big_stack) {
+        max_on_big_stack = on_big_stack;
+    }
+    int sum = recurse(id, DEPTH);
+    on_big_stack--;
+    return (void*)(long)sum;
+}
+
+// A nested call runs on the big stack we already hold
+void* nested(void *arg) {
+    void *ret = 0;
+    if (call_on_big_stack(deep, arg, &ret) < 0) {
+        return 0;
+    }
+    return ret;
+}
+
+// Leave the thread from the big stack instead of returning
+void* exit_deep(void *arg) {
+    thread_exit(arg);
+    return 0;
+}
+
+void* quitter(void *arg) {
+    call_on_big_stack(exit_deep, arg, 0);
+    return 0;  // Not reached
+}
+
+void* worker(void *arg) {
+    int id = (int)(long)arg;
+    int wrong = 0;
+
+    for (int i = 0; i < CALLS; i++) {
+        void *ret = 0;
+        if (call_on_big_stack(i == 0 ? nested : deep, arg, &ret) < 0 ||
+            (long)ret != (DEPTH + 1) * id) {
+            wrong++;
+        }
+        thread_yield();
+    }
+    return (void*)(long)wrong;
+}
+
+int main(void) {
+    printf("Big Stack Test\n");
+    printf("==============\n\n");
+
+    thread_init();
+
+    thread_attr_t small;
+    thread_attr_init(&small);
+    thread_attr_setstacksize(&small, SMALL_STACK);
+
+    int tids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        tids[i] = thread_create_ex(&small, worker, (void*)(long)(i + 1));
+    }
+    int wrong = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        wrong += (int)(long)thread_join(tids[i]);
+    }
+
+    // The big stack is free again after its owner exits on it
+    if (thread_join(thread_create_ex(&small, quitter, (void*)7L)) != (void*)7L) {
+        wrong++;
+    }
+    if (thread_join(thread_create_ex(&small, worker, (void*)1L)) != 0) {
+        wrong++;
+    }
+
+    printf("Wrong results: %d, corrupted frames: %d\n", wrong, corrupted);
+    printf("Most threads on the big stack at once: %d\n", max_on_big_stack);
+
+    if (wrong == 0 && corrupted == 0 && max_on_big_stack == 1) {
+        printf("SUCCESS! Deep calls ran on the big stack one at a time.\n");
+    } else {
+        printf("FAILURE! call_on_big_stack is broken.\n");
+    }
+
+    exit();
+}
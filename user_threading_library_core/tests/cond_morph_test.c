@@ -0,0 +1,90 @@
+// Wait morphing test - cond_broadcast while the mutex is held must not
+// wake the waiters just to block them again on the mutex. They stay asleep
+// until the unlock and then take the lock one at a time, in wait order.
+
+#include "../src/uthreads.h"
+
+#define NUM_WAITERS 4
+
+mutex_t lock;
+cond_t go;
+int ready = 0;
+int waiting = 0;
+
+// Order in which the waiters got the lock after the broadcast
+int order[NUM_WAITERS];
+int finished = 0;
+
+void* waiter(void *arg) {
+    mutex_lock(&lock);
+    waiting++;
+    while (!ready) {
+        cond_wait(&go, &lock);
+    }
+    order[finished++] = (int)(long)arg;
+    mutex_unlock(&lock);
+    return 0;
+}
+
+// Run one broadcast round with the given mutex mode; returns 1 on success
+int run(int mode, char *name) {
+    mutex_init_mode(&lock, mode);
+    cond_init(&go);
+    ready = 0;
+    waiting = 0;
+    finished = 0;
+
+    int tids[NUM_WAITERS];
+    for (int i = 0; i < NUM_WAITERS; i++) {
+        tids[i] = thread_create(waiter, (void*)(long)i);
+    }
+    while (waiting < NUM_WAITERS) {
+        thread_yield();
+    }
+
+    // Broadcast with the mutex held, then check that nobody became runnable
+    mutex_lock(&lock);
+    ready = 1;
+    cond_broadcast(&go);
+    int woken = 0;
+    for (int i = 0; i < NUM_WAITERS; i++) {
+        if (thread_yield_to(tids[i]) == 0) {
+            woken++;
+        }
+    }
+    mutex_unlock(&lock);
+
+    for (int i = 0; i < NUM_WAITERS; i++) {
+        thread_join(tids[i]);
+    }
+
+    int in_order = (finished == NUM_WAITERS);
+    for (int i = 0; i < finished; i++) {
+        if (order[i] != i) {
+            in_order = 0;
+        }
+    }
+    printf("%s: %d of %d waiters woken before the unlock, lock order %s\n",
+           name, woken, NUM_WAITERS, in_order ? "FIFO" : "wrong");
+    return woken == 0 && in_order;
+}
+
+int main(void) {
+    printf("Wait Morphing Test\n");
+    printf("==================\n\n");
+
+    thread_init();
+
+    int ok = run(MUTEX_NORMAL, "normal ");
+    if (!run(MUTEX_HANDOFF, "handoff")) {
+        ok = 0;
+    }
+
+    if (ok) {
+        printf("SUCCESS! Broadcast waiters woke only when they could lock.\n");
+    } else {
+        printf("FAILURE! Broadcast woke waiters that could not lock.\n");
+    }
+
+    exit();
+}
@@ -0,0 +1,86 @@
+// Coroutine test - thousands of stackless coroutines on one host thread,
+// each waiting on a semaphore, yielding, then sending on a channel that
+// main drains
+
+#include "../src/uthreads.h"
+
+#define NUM_TASKS 10000
+
+// Per-task state (everything that must survive a CORO_* statement)
+struct task {
+    coro_t co;
+    int id;
+    int ret;
+};
+
+sem_t go;
+channel_t *out;
+coro_sched_t sched;
+
+int task_body(coro_t *co) {
+    struct task *t = (struct task*)co->arg;
+
+    CORO_BEGIN(co);
+    CORO_SEM_WAIT(co, &go);
+    CORO_YIELD(co);
+    CORO_CHAN_SEND(co, out, (void*)(long)t->id, t->ret);
+    CORO_END(co);
+}
+
+void* host(void *arg) {
+    coro_run(&sched);
+    return 0;
+}
+
+int main(void) {
+    printf("Stackless Coroutine Test\n");
+    printf("========================\n\n");
+
+    thread_init();
+
+    sem_init(&go, 0);
+    out = channel_create(16);
+    coro_sched_init(&sched);
+
+    struct task *tasks = (struct task*)malloc(NUM_TASKS * sizeof(struct task));
+    if (out == 0 || tasks == 0) {
+        printf("FAILURE! Out of memory.\n");
+        exit();
+    }
+    for (int i = 0; i < NUM_TASKS; i++) {
+        tasks[i].id = i;
+        coro_spawn(&sched, &tasks[i].co, task_body, &tasks[i]);
+    }
+    printf("Spawned %d coroutines (%d bytes each)\n",
+           NUM_TASKS, (int)sizeof(struct task));
+
+    int host_tid = thread_create(host, 0);
+
+    // Release the tasks one at a time and collect what they send
+    long sum = 0;
+    int received = 0;
+    for (int i = 0; i < NUM_TASKS; i++) {
+        sem_post(&go);
+    }
+    for (int i = 0; i < NUM_TASKS; i++) {
+        void *data;
+        if (channel_recv(out, &data) < 0) {
+            break;
+        }
+        sum += (long)data;
+        received++;
+    }
+    thread_join(host_tid);
+
+    long expected = (long)NUM_TASKS * (NUM_TASKS - 1) / 2;
+    printf("Received %d messages, sum %d (expected %d)\n",
+           received, (int)sum, (int)expected);
+
+    if (received == NUM_TASKS && sum == expected && sched.live == 0) {
+        printf("SUCCESS! All coroutines ran to completion.\n");
+    } else {
+        printf("FAILURE! Coroutines were lost.\n");
+    }
+
+    exit();
+}
@@ -0,0 +1,106 @@
+// FPU isolation test - threads created with THREAD_ATTR_FPU each pick a
+// different x87 rounding mode, then yield back and forth (with an
+// integer-only thread in the mix) and check nobody saw another's mode.
+// A second round sums doubles in registers under a 1-tick quantum, so
+// preemption lands mid-loop and must not disturb the SSE registers
+
+#include "../src/uthreads.h"
+
+#define NUM_FP 4
+#define ITERATIONS 50
+#define SUM_TERMS 2000000
+
+#if defined(__i386__) || defined(__x86_64__)
+static ushort get_cw(void) {
+    ushort cw;
+    asm volatile("fnstcw %0" : "=m"(cw));
+    return cw;
+}
+
+static void set_cw(ushort cw) {
+    asm volatile("fldcw %0" : : "m"(cw));
+}
+#endif
+
+// Number of times a thread found the wrong rounding mode
+int mismatches = 0;
+
+// Thread function: set rounding mode id, then keep checking it
+void* fp_worker(void *arg) {
+#if defined(__i386__) || defined(__x86_64__)
+    ushort mode = (ushort)((long)arg << 10);  // RC field is bits 10-11
+    set_cw((get_cw() & ~0x0C00) | mode);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        thread_yield();
+        if ((get_cw() & 0x0C00) != mode) {
+            mismatches++;
+        }
+    }
+#endif
+    return 0;
+}
+
+// Thread function: sum halves in a tight loop with no yields, so only
+// preemption switches away; returns 1 if the total came out wrong
+void* fp_summer(void *arg) {
+    double sum = 0;
+    double step = 0.5 * (1 + (long)arg);
+    for (int i = 0; i < SUM_TERMS; i++) {
+        sum += step;
+    }
+    return (void*)(long)(sum != step * SUM_TERMS);
+}
+
+// Thread function: integer work only, never touches the FPU
+void* int_worker(void *arg) {
+    int sum = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        sum += i;
+        thread_yield();
+    }
+    return (void*)(long)sum;
+}
+
+int main(void) {
+    printf("FPU Isolation Test\n");
+    printf("==================\n\n");
+
+    thread_init();
+
+    thread_attr_t attr;
+    thread_attr_init(&attr);
+    thread_attr_setfpu(&attr, 1);
+
+    int tids[NUM_FP + 1];
+    for (int i = 0; i < NUM_FP; i++) {
+        tids[i] = thread_create_ex(&attr, fp_worker, (void*)(long)i);
+    }
+    tids[NUM_FP] = thread_create(int_worker, 0);
+
+    for (int i = 0; i <= NUM_FP; i++) {
+        thread_join(tids[i]);
+    }
+
+    printf("Rounding-mode mismatches: %d\n", mismatches);
+
+    // Round 2: preempted FP threads
+    int wrong_sums = 0;
+    thread_set_quantum(1);
+    for (int i = 0; i < NUM_FP; i++) {
+        tids[i] = thread_create_ex(&attr, fp_summer, (void*)(long)i);
+    }
+    for (int i = 0; i < NUM_FP; i++) {
+        wrong_sums += (int)(long)thread_join(tids[i]);
+    }
+    thread_set_quantum(0);
+    printf("Wrong sums under preemption: %d of %d\n", wrong_sums, NUM_FP);
+
+    if (mismatches == 0 && wrong_sums == 0) {
+        printf("SUCCESS! Each FP thread kept its own FPU state.\n");
+    } else {
+        printf("FAILURE! FPU state leaked between threads.\n");
+    }
+
+    exit();
+}
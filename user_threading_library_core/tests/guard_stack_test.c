@@ -0,0 +1,81 @@
+// Guarded stack test - runs threads on small stacks with guard pages
+// Run with "overflow" to watch the kernel catch a stack overflow:
+//   $ t_guard_stack_test overflow
+
+#include "../src/uthreads.h"
+
+#define NUM_THREADS 8
+#define SMALL_STACK 4096
+#define SAFE_DEPTH 16
+
+// Recurse depth times, using some stack in each frame
+int recurse(int depth) {
+    volatile char frame[64];
+    frame[0] = (char)depth;
+    if (depth == 0) {
+        return 0;
+    }
+    return recurse(depth - 1) + 1 + frame[0] - (char)depth;
+}
+
+// Thread function: recursion that fits comfortably in the stack
+void* safe_worker(void *arg) {
+    int n = (int)(long)arg;
+    int depth = recurse(SAFE_DEPTH);
+    thread_yield();
+    return (void*)(long)(n + depth);
+}
+
+// Thread function: unbounded recursion that runs into the guard page
+void* overflow_worker(void *arg) {
+    printf("Thread %d: recursing until the stack overflows...\n", thread_self());
+    recurse(1 << 20);
+    printf("FAILURE! Overflow was not caught.\n");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    printf("Guarded Stack Test\n");
+    printf("==================\n\n");
+
+    thread_init();
+
+    thread_attr_t attr;
+    thread_attr_init(&attr);
+    thread_attr_setstacksize(&attr, SMALL_STACK);
+    thread_attr_setguard(&attr, 1);
+
+    if (argc > 1 && strcmp(argv[1], "overflow") == 0) {
+        int tid = thread_create_ex(&attr, overflow_worker, 0);
+        printf("Created thread %d; the kernel should report its overflow\n", tid);
+        thread_join(tid);
+        exit();
+    }
+
+    // Run two rounds so the second reuses cached guarded stacks
+    int bad = 0;
+    for (int round = 0; round < 2; round++) {
+        int tids[NUM_THREADS];
+        for (int i = 0; i < NUM_THREADS; i++) {
+            tids[i] = thread_create_ex(&attr, safe_worker, (void*)(long)i);
+            if (tids[i] < 0) {
+                printf("thread_create_ex failed (is the guardpage syscall installed?)\n");
+                exit();
+            }
+        }
+        for (int i = 0; i < NUM_THREADS; i++) {
+            if ((int)(long)thread_join(tids[i]) != i + SAFE_DEPTH) {
+                bad++;
+            }
+        }
+        printf("Round %d: %d guarded threads joined\n", round + 1, NUM_THREADS);
+    }
+
+    if (bad == 0) {
+        printf("SUCCESS! Guarded threads ran correctly.\n");
+    } else {
+        printf("FAILURE! %d threads returned wrong values.\n", bad);
+    }
+
+    exit();
+}
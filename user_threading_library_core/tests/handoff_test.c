@@ -0,0 +1,107 @@
+// Directed switch test - thread_yield_to runs the chosen thread next, and
+// a channel ping-pong hands the CPU straight to the receiver instead of
+// waiting behind every other runnable thread
+
+#include "../src/uthreads.h"
+
+#define NUM_SPINNERS 4
+#define ROUNDS 100
+
+channel_t *ping;
+channel_t *pong;
+
+// Set while the ping-pong runs; spinners count how often they got the CPU
+int measuring = 0;
+int spinner_runs = 0;
+int stop = 0;
+
+// Which thread ran after thread_yield_to
+int ran_first = -1;
+
+void* spinner(void *arg) {
+    while (!stop) {
+        if (measuring) {
+            spinner_runs++;
+        }
+        thread_yield();
+    }
+    return 0;
+}
+
+void* target(void *arg) {
+    if (ran_first < 0) {
+        ran_first = (int)(long)arg;
+    }
+    return 0;
+}
+
+// Echo every message on ping back on pong
+void* echo(void *arg) {
+    void *msg;
+    while (channel_recv(ping, &msg) == 0) {
+        channel_send(pong, msg);
+    }
+    return 0;
+}
+
+int main(void) {
+    printf("Directed Switch Test\n");
+    printf("====================\n\n");
+
+    thread_init();
+
+    // Test 1: thread_yield_to picks the last-created thread over the others
+    int first = thread_create(target, (void*)1L);
+    int second = thread_create(target, (void*)2L);
+    int third = thread_create(target, (void*)3L);
+    int ok = (thread_yield_to(third) == 0);
+    thread_join(first);
+    thread_join(second);
+    thread_join(third);
+    printf("thread_yield_to: thread %d ran first\n", ran_first);
+    if (ran_first != 3) {
+        ok = 0;
+    }
+    if (thread_yield_to(third) != -1) {
+        ok = 0;  // Joined threads are not runnable
+    }
+
+    // Test 2: channel ping-pong with busy threads in the run queue
+    ping = channel_create(1);
+    pong = channel_create(1);
+    int spinners[NUM_SPINNERS];
+    for (int i = 0; i < NUM_SPINNERS; i++) {
+        spinners[i] = thread_create(spinner, 0);
+    }
+    int echo_tid = thread_create(echo, 0);
+
+    measuring = 1;
+    for (int i = 0; i < ROUNDS; i++) {
+        void *reply;
+        channel_send(ping, (void*)(long)i);
+        if (channel_recv(pong, &reply) < 0 || (long)reply != i) {
+            ok = 0;
+        }
+    }
+    measuring = 0;
+
+    stop = 1;
+    channel_close(ping);
+    thread_join(echo_tid);
+    for (int i = 0; i < NUM_SPINNERS; i++) {
+        thread_join(spinners[i]);
+    }
+
+    printf("Ping-pong: %d rounds, spinners ran %d times\n", ROUNDS, spinner_runs);
+    if (spinner_runs > ROUNDS) {
+        ok = 0;  // Without handoff this is about NUM_SPINNERS per round trip
+    }
+
+    if (ok) {
+        printf("SUCCESS! Woken threads ran without waiting their turn.\n");
+    } else {
+        printf("FAILURE! Directed switching did not work.\n");
+    }
+
+    exit();
+}
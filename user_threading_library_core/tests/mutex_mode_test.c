@@ -0,0 +1,71 @@
+// Mutex mode test - a lock convoy (every thread re-locks right after
+// unlocking) under MUTEX_NORMAL, MUTEX_HYBRID and MUTEX_HANDOFF. Counts
+// how often the unlocking thread barged back in ahead of the waiters.
+
+#include "../src/uthreads.h"
+
+#define NUM_THREADS 4
+#define ITERATIONS 200
+
+mutex_t lock;
+int counter = 0;
+
+// Thread that took the lock last, and how often it was the same one again
+int last_owner = -1;
+int reacquired = 0;
+
+// Thread function: lock, yield while holding the lock, unlock, repeat
+void* convoy(void *arg) {
+    for (int i = 0; i < ITERATIONS; i++) {
+        mutex_lock(&lock);
+        if (last_owner == thread_self()) {
+            reacquired++;
+        }
+        last_owner = thread_self();
+        counter++;
+        thread_yield();
+        mutex_unlock(&lock);
+    }
+    return 0;
+}
+
+// Run the convoy with the given mode; returns the number of re-acquisitions
+int run(int mode, char *name) {
+    mutex_init_mode(&lock, mode);
+    counter = 0;
+    last_owner = -1;
+    reacquired = 0;
+
+    int tids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        tids[i] = thread_create(convoy, 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_join(tids[i]);
+    }
+
+    printf("%s: counter = %d, re-acquired by the unlocker %d times\n",
+           name, counter, reacquired);
+    return counter == NUM_THREADS * ITERATIONS ? reacquired : -1;
+}
+
+int main(void) {
+    printf("Mutex Mode Test\n");
+    printf("===============\n\n");
+
+    thread_init();
+
+    int normal = run(MUTEX_NORMAL, "normal ");
+    int hybrid = run(MUTEX_HYBRID, "hybrid ");
+    int handoff = run(MUTEX_HANDOFF, "handoff");
+
+    // Handoff never lets the unlocker back in while others wait; hybrid
+    // bounds the barging that normal mode allows
+    if (normal >= 0 && hybrid >= 0 && handoff == 0 && hybrid <= normal) {
+        printf("SUCCESS! Handoff mode stopped barging.\n");
+    } else {
+        printf("FAILURE! Unexpected mutex behavior.\n");
+    }
+
+    exit();
+}
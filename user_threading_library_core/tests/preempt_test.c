@@ -0,0 +1,54 @@
+// Preemption test - two threads that never yield still both make progress
+// when a time quantum is set (needs the sigalarm syscall)
+
+#include "../src/uthreads.h"
+
+#define QUANTUM_TICKS 1
+#define TARGET 1000000
+
+// Progress counters, one per thread
+volatile int progress[2];
+
+// Thread function: spin without ever yielding until the other thread has
+// also made progress. Without preemption the first one to run spins forever.
+void* spinner(void *arg) {
+    int me = (int)(long)arg;
+    int other = 1 - me;
+
+    while (progress[me] < TARGET || progress[other] < TARGET) {
+        if (progress[me] < TARGET) {
+            progress[me]++;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    printf("Preemption Test\n");
+    printf("===============\n\n");
+
+    thread_init();
+
+    if (thread_set_quantum(QUANTUM_TICKS) < 0) {
+        printf("thread_set_quantum failed (is the sigalarm syscall installed?)\n");
+        exit();
+    }
+    printf("Quantum set to %d tick(s)\n", QUANTUM_TICKS);
+
+    int t0 = thread_create(spinner, (void*)0);
+    int t1 = thread_create(spinner, (void*)1);
+    thread_join(t0);
+    thread_join(t1);
+
+    thread_set_quantum(0);
+
+    printf("Progress: thread %d = %d, thread %d = %d\n",
+           t0, progress[0], t1, progress[1]);
+    if (progress[0] == TARGET && progress[1] == TARGET) {
+        printf("SUCCESS! Non-yielding threads were preempted.\n");
+    } else {
+        printf("FAILURE! Threads did not both finish.\n");
+    }
+
+    exit();
+}
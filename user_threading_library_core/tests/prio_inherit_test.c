@@ -0,0 +1,121 @@
+// Priority inheritance test - a low-priority thread holds a mutex that a
+// high-priority thread needs while a medium-priority thread keeps the CPU
+// busy. With MUTEX_PRIO_INHERIT the holder is boosted (through a chain of
+// two mutexes in the second round), so the medium thread never runs
+// before the high one gets the lock.
+
+#include "../src/uthreads.h"
+
+#define HIGH_PRIO 2
+#define CHAIN_PRIO 8
+#define MEDIUM_PRIO 12
+#define LOW_PRIO 20
+#define MAIN_PRIO 28
+#define SPIN_LIMIT 100
+
+mutex_t a;
+mutex_t b;
+int chain = 0;
+
+int tids[3];
+int high_done = 0;
+int spins = 0;
+int restored = 0;
+
+int create_at(int prio, void* (*fn)(void*)) {
+    thread_attr_t attr;
+    thread_attr_init(&attr);
+    thread_attr_setprio(&attr, prio);
+    return thread_create_ex(&attr, fn, 0);
+}
+
+// Needs the lock the low thread holds (directly, or via the chain thread)
+void* high(void *arg) {
+    mutex_lock(chain ? &b : &a);
+    high_done = 1;
+    mutex_unlock(chain ? &b : &a);
+    return 0;
+}
+
+// Holds b while waiting for a, so high waits on a waiter
+void* middle(void *arg) {
+    mutex_lock(&b);
+    mutex_lock(&a);
+    mutex_unlock(&a);
+    mutex_unlock(&b);
+    return 0;
+}
+
+// Busy thread that outranks the low thread, but not the high one. Without
+// inheritance only aging (or SPIN_LIMIT) lets the low thread run again
+void* medium(void *arg) {
+    while (!high_done && spins < SPIN_LIMIT) {
+        spins++;
+        thread_yield();
+    }
+    return 0;
+}
+
+void* low(void *arg) {
+    mutex_lock(&a);
+    if (chain) {
+        tids[2] = create_at(CHAIN_PRIO, middle);
+        thread_yield();  // middle takes b and blocks on a
+    }
+    tids[0] = create_at(HIGH_PRIO, high);
+    tids[1] = create_at(MEDIUM_PRIO, medium);
+    thread_yield();      // high blocks; medium competes with us
+    mutex_unlock(&a);
+    restored = (thread_getprio(thread_self()) == LOW_PRIO);
+    return 0;
+}
+
+// Run one round; returns how often medium ran before high got its lock
+int run(int mode, int with_chain, char *name) {
+    mutex_init_mode(&a, mode);
+    mutex_init_mode(&b, mode);
+    chain = with_chain;
+    high_done = 0;
+    spins = 0;
+    restored = 0;
+
+    thread_join(create_at(LOW_PRIO, low));
+    thread_join(tids[0]);
+    thread_join(tids[1]);
+    if (chain) {
+        thread_join(tids[2]);
+    }
+
+    printf("%s: medium ran %d times first, low priority %s\n",
+           name, spins, restored ? "restored" : "NOT restored");
+    return restored ? spins : -1;
+}
+
+int main(void) {
+    printf("Priority Inheritance Test\n");
+    printf("=========================\n\n");
+
+    thread_init();
+    thread_setprio(thread_self(), MAIN_PRIO);
+
+    int normal = run(MUTEX_NORMAL, 0, "normal       ");
+    int direct = run(MUTEX_PRIO_INHERIT, 0, "inherit      ");
+    int chained = run(MUTEX_PRIO_INHERIT, 1, "inherit chain");
+
+    // Reprioritising a thread that has not started must not boost anyone
+    int idle = create_at(LOW_PRIO, medium);
+    thread_setprio(idle, HIGH_PRIO);
+    int main_prio = thread_getprio(thread_self());
+    high_done = 1;
+    thread_join(idle);
+    printf("setprio before start: main priority %d (expected %d)\n",
+           main_prio, MAIN_PRIO);
+
+    if (normal > 0 && direct == 0 && chained == 0 && main_prio == MAIN_PRIO) {
+        printf("SUCCESS! Lock holders ran at their waiters' priority.\n");
+    } else {
+        printf("FAILURE! Priority inversion was not prevented.\n");
+    }
+
+    exit();
+}
@@ -0,0 +1,101 @@
+// Priority scheduling test - high-priority threads run before low-priority
+// ones, and aging keeps low-priority threads from starving
+
+#include "../src/uthreads.h"
+
+#define NUM_EACH 3
+#define ITERATIONS 3
+#define HIGH_PRIO 4
+#define LOW_PRIO 24
+
+// Finish order of the workers
+int finish_order[2 * NUM_EACH];
+int finished = 0;
+
+// Set by the low-priority thread in the aging test
+int low_ran = 0;
+
+// Thread function: yield a few times, then record when we finished
+void* worker(void *arg) {
+    int id = (int)(long)arg;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        thread_yield();
+    }
+
+    finish_order[finished++] = id;
+    return 0;
+}
+
+// Thread function: high-priority thread that keeps yielding until the
+// low-priority thread gets to run
+void* spinner(void *arg) {
+    while (!low_ran) {
+        thread_yield();
+    }
+    return 0;
+}
+
+void* low_flag(void *arg) {
+    low_ran = 1;
+    return 0;
+}
+
+int main(void) {
+    printf("Priority Scheduling Test\n");
+    printf("========================\n\n");
+
+    thread_init();
+
+    // Test 1: strict priority order (aging off)
+    thread_set_aging(0);
+
+    thread_attr_t high, low;
+    thread_attr_init(&high);
+    thread_attr_init(&low);
+    thread_attr_setprio(&high, HIGH_PRIO);
+    thread_attr_setprio(&low, LOW_PRIO);
+
+    // Create low-priority threads first so FIFO order alone would run them first
+    int tids[2 * NUM_EACH];
+    for (int i = 0; i < NUM_EACH; i++) {
+        tids[i] = thread_create_ex(&low, worker, (void*)(long)(100 + i));
+    }
+    for (int i = 0; i < NUM_EACH; i++) {
+        tids[NUM_EACH + i] = thread_create_ex(&high, worker, (void*)(long)i);
+    }
+
+    for (int i = 0; i < 2 * NUM_EACH; i++) {
+        thread_join(tids[i]);
+    }
+
+    printf("Finish order:");
+    int ok = 1;
+    for (int i = 0; i < 2 * NUM_EACH; i++) {
+        printf(" %d", finish_order[i]);
+        // The first NUM_EACH finishers must all be high-priority (id < 100)
+        if ((i < NUM_EACH) != (finish_order[i] < 100)) {
+            ok = 0;
+        }
+    }
+    printf("\n");
+    printf("%s\n\n", ok ? "High-priority threads finished first." :
+                          "FAILURE! Priorities were not respected.");
+
+    // Test 2: aging lets a low-priority thread run while a
+    // high-priority thread never blocks
+    thread_set_aging(THREAD_AGING_INTERVAL);
+    int spin_tid = thread_create_ex(&high, spinner, 0);
+    int low_tid = thread_create_ex(&low, low_flag, 0);
+    thread_join(spin_tid);
+    thread_join(low_tid);
+    printf("Aging: low-priority thread ran = %d\n", low_ran);
+
+    if (ok && low_ran) {
+        printf("SUCCESS! Priority scheduling works.\n");
+    } else {
+        printf("FAILURE! Priority scheduling is broken.\n");
+    }
+
+    exit();
+}
@@ -0,0 +1,151 @@
+// Reader-writer lock test - readers share the lock, a queued writer holds
+// back new readers only in RWLOCK_PREFER_WRITER mode, readers queued
+// behind a writer are admitted together, and writers stay exclusive
+
+#include "../src/uthreads.h"
+
+#define NUM_READERS 4
+#define NUM_WRITERS 2
+#define ROUNDS 20
+
+rwlock_t rw;
+
+// Readers holding the lock right now, and the most seen at once
+int inside = 0;
+int max_inside = 0;
+
+// Order in which the writer and the late reader got the lock
+char order[3];
+int order_len = 0;
+
+// Writers keep shared_data even whenever they release the lock
+int shared_data = 0;
+int torn_reads = 0;
+
+void* reader(void *arg) {
+    rwlock_rdlock(&rw);
+    if (arg) {
+        order[order_len++] = 'R';
+    }
+    inside++;
+    if (inside > max_inside) {
+        max_inside = inside;
+    }
+    thread_yield();
+    inside--;
+    rwlock_unlock(&rw);
+    return 0;
+}
+
+void* writer(void *arg) {
+    rwlock_wrlock(&rw);
+    order[order_len++] = 'W';
+    rwlock_unlock(&rw);
+    return 0;
+}
+
+// Reader and writer loops for the exclusion test
+void* checker(void *arg) {
+    for (int i = 0; i < ROUNDS; i++) {
+        rwlock_rdlock(&rw);
+        if (shared_data % 2 != 0) {
+            torn_reads++;
+        }
+        thread_yield();
+        rwlock_unlock(&rw);
+    }
+    return 0;
+}
+
+void* incrementer(void *arg) {
+    for (int i = 0; i < ROUNDS; i++) {
+        rwlock_wrlock(&rw);
+        shared_data++;
+        thread_yield();
+        shared_data++;
+        rwlock_unlock(&rw);
+        thread_yield();
+    }
+    return 0;
+}
+
+// A writer queues behind main's read hold, then a reader arrives.
+// Returns the order they got the lock ("WR" or "RW")
+char* preference(int mode) {
+    rwlock_init_mode(&rw, mode);
+    order_len = 0;
+
+    rwlock_rdlock(&rw);
+    int w = thread_create(writer, 0);
+    thread_yield();
+    int r = thread_create(reader, (void*)1L);
+    thread_yield();
+    rwlock_unlock(&rw);
+    thread_join(w);
+    thread_join(r);
+
+    order[order_len] = 0;
+    return order;
+}
+
+int main(void) {
+    printf("Reader-Writer Lock Test\n");
+    printf("=======================\n\n");
+
+    thread_init();
+    int ok = 1;
+
+    // Test 1: who goes first when a writer is already waiting
+    char *prefer_writer = preference(RWLOCK_PREFER_WRITER);
+    printf("Writer preference: lock order %s (expected WR)\n", prefer_writer);
+    if (prefer_writer[0] != 'W' || prefer_writer[1] != 'R') {
+        ok = 0;
+    }
+    char *prefer_reader = preference(RWLOCK_PREFER_READER);
+    printf("Reader preference: lock order %s (expected RW)\n", prefer_reader);
+    if (prefer_reader[0] != 'R' || prefer_reader[1] != 'W') {
+        ok = 0;
+    }
+
+    // Test 2: readers queued behind a writer all get in when it leaves
+    rwlock_init(&rw);
+    max_inside = 0;
+    int tids[NUM_READERS + NUM_WRITERS];
+    rwlock_wrlock(&rw);
+    for (int i = 0; i < NUM_READERS; i++) {
+        tids[i] = thread_create(reader, 0);
+    }
+    thread_yield();
+    rwlock_unlock(&rw);
+    for (int i = 0; i < NUM_READERS; i++) {
+        thread_join(tids[i]);
+    }
+    printf("Batch admission: %d of %d readers inside at once\n", max_inside, NUM_READERS);
+    if (max_inside != NUM_READERS) {
+        ok = 0;
+    }
+
+    // Test 3: writers exclude readers and each other
+    for (int i = 0; i < NUM_READERS; i++) {
+        tids[i] = thread_create(checker, 0);
+    }
+    for (int i = 0; i < NUM_WRITERS; i++) {
+        tids[NUM_READERS + i] = thread_create(incrementer, 0);
+    }
+    for (int i = 0; i < NUM_READERS + NUM_WRITERS; i++) {
+        thread_join(tids[i]);
+    }
+    printf("Exclusion: shared_data = %d (expected %d), torn reads %d\n",
+           shared_data, 2 * NUM_WRITERS * ROUNDS, torn_reads);
+    if (shared_data != 2 * NUM_WRITERS * ROUNDS || torn_reads != 0 || rw.state != 0) {
+        ok = 0;
+    }
+
+    if (ok) {
+        printf("SUCCESS! Reader-writer lock works.\n");
+    } else {
+        printf("FAILURE! Reader-writer lock misbehaved.\n");
+    }
+
+    exit();
+}
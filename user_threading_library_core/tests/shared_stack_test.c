@@ -0,0 +1,113 @@
+// Shared-stack test - THREAD_ATTR_SHARED threads keep their stack contents
+// while other threads run on the same stack, and parked shared threads
+// cost far less memory than threads with private stacks
+
+#include "../src/uthreads.h"
+
+#define NUM_SHARED 6
+#define DEPTH 8
+#define YIELDS 5
+#define NUM_IDLE 400
+
+thread_attr_t shared;
+
+// Number of corrupted stack frames seen on the way back up
+int corrupted = 0;
+
+// Recurse with a frame full of a thread-specific pattern, yield at the
+// bottom so other threads reuse the shared stack, then check each frame
+void recurse(int id, int depth) {
+    char frame[64];
+    for (int i = 0; i < sizeof(frame); i++) {
+        frame[i] = (char)(id * 31 + depth * 7 + i);
+    }
+
+    if (depth > 0) {
+        recurse(id, depth - 1);
+    } else {
+        for (int i = 0; i < YIELDS; i++) {
+            thread_yield();
+        }
+    }
+
+    for (int i = 0; i < sizeof(frame); i++) {
+        if (frame[i] != (char)(id * 31 + depth * 7 + i)) {
+            corrupted++;
+            return;
+        }
+    }
+}
+
+void* worker(void *arg) {
+    recurse((int)(long)arg, DEPTH);
+    return arg;
+}
+
+sem_t go;
+
+// Thread function: use a little stack, then park until released
+void* idler(void *arg) {
+    char buf[128];
+    memset(buf, (int)(long)arg, sizeof(buf));
+    sem_wait(&go);
+    return (void*)(long)(unsigned char)buf[sizeof(buf) - 1];
+}
+
+// Create NUM_IDLE parked threads and return the heap growth per thread
+int idle_cost(thread_attr_t *attr) {
+    int tids[NUM_IDLE];
+    char *before = (char*)sbrk(0);
+
+    for (int i = 0; i < NUM_IDLE; i++) {
+        tids[i] = thread_create_ex(attr, idler, (void*)(long)i);
+    }
+    thread_yield();  // Let every idler run until it parks on go
+    int per_thread = ((char*)sbrk(0) - before) / NUM_IDLE;
+
+    for (int i = 0; i < NUM_IDLE; i++) {
+        sem_post(&go);
+    }
+    for (int i = 0; i < NUM_IDLE; i++) {
+        if ((long)thread_join(tids[i]) != (i & 0xff)) {
+            corrupted++;
+        }
+    }
+    return per_thread;
+}
+
+int main(void) {
+    printf("Shared Stack Test\n");
+    printf("=================\n\n");
+
+    thread_init();
+
+    thread_attr_init(&shared);
+    thread_attr_setshared(&shared, 1);
+
+    // Test 1: stack contents survive switches, mixed with private-stack threads
+    int tids[NUM_SHARED + 2];
+    for (int i = 0; i < NUM_SHARED; i++) {
+        tids[i] = thread_create_ex(&shared, worker, (void*)(long)(i + 1));
+    }
+    tids[NUM_SHARED] = thread_create(worker, (void*)100L);
+    tids[NUM_SHARED + 1] = thread_create(worker, (void*)101L);
+    for (int i = 0; i < NUM_SHARED + 2; i++) {
+        thread_join(tids[i]);
+    }
+    printf("Corrupted frames: %d\n", corrupted);
+
+    // Test 2: memory per parked thread
+    sem_init(&go, 0);
+    int shared_cost = idle_cost(&shared);
+    int private_cost = idle_cost(0);
+    printf("Heap per parked thread: shared %d bytes, private %d bytes\n",
+           shared_cost, private_cost);
+
+    if (corrupted == 0 && shared_cost * 10 <= private_cost) {
+        printf("SUCCESS! Shared-stack threads work.\n");
+    } else {
+        printf("FAILURE! Shared-stack threads are broken.\n");
+    }
+
+    exit();
+}
@@ -0,0 +1,70 @@
+// Sleep test - threads sleeping for different tick counts wake in deadline
+// order, no earlier than requested, and the process idles in the kernel
+// while everyone is asleep
+
+#include "../src/uthreads.h"
+
+#define NUM_SLEEPERS 4
+
+// Ticks each sleeper asks for (deliberately not in creation order)
+int delays[NUM_SLEEPERS] = { 30, 10, 40, 20 };
+
+// Wake order of the sleepers
+int wake_order[NUM_SLEEPERS];
+int woken = 0;
+
+// Number of sleepers that woke before their deadline
+int early = 0;
+
+// Thread function: sleep, then record when we woke
+void* sleeper(void *arg) {
+    int id = (int)(long)arg;
+    int start = uptime();
+
+    thread_sleep(delays[id]);
+
+    if (uptime() - start < delays[id]) {
+        early++;
+    }
+    wake_order[woken++] = id;
+    return 0;
+}
+
+int main(void) {
+    printf("Thread Sleep Test\n");
+    printf("=================\n\n");
+
+    thread_init();
+
+    int tids[NUM_SLEEPERS];
+    for (int i = 0; i < NUM_SLEEPERS; i++) {
+        tids[i] = thread_create(sleeper, (void*)(long)i);
+    }
+
+    // Joining blocks main while every other thread sleeps, so the
+    // scheduler has to idle until the earliest deadline
+    int start = uptime();
+    for (int i = 0; i < NUM_SLEEPERS; i++) {
+        thread_join(tids[i]);
+    }
+    int elapsed = uptime() - start;
+
+    printf("Wake order (ticks):");
+    int ok = (woken == NUM_SLEEPERS && early == 0);
+    for (int i = 0; i < woken; i++) {
+        printf(" %d", delays[wake_order[i]]);
+        if (i > 0 && delays[wake_order[i]] < delays[wake_order[i - 1]]) {
+            ok = 0;
+        }
+    }
+    printf("\n");
+    printf("Elapsed: %d ticks, woke early: %d\n", elapsed, early);
+
+    if (ok) {
+        printf("SUCCESS! Sleepers woke in deadline order.\n");
+    } else {
+        printf("FAILURE! Sleepers woke out of order or too early.\n");
+    }
+
+    exit();
+}
@@ -0,0 +1,89 @@
+// Thread table growth test - runs far more threads than the initial table size
+
+#include "../src/uthreads.h"
+
+#define NUM_THREADS 200
+#define ROUNDS 3
+#define SMALL_STACK 1024
+#define CHURN_ROUNDS 1000
+
+int finished = 0;
+
+// Thread function: yield a few times, then return its argument doubled
+void* worker(void *arg) {
+    int n = (int)(long)arg;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        thread_yield();
+    }
+
+    finished++;
+    return (void*)(long)(n * 2);
+}
+
+int main(void) {
+    printf("Thread Stress Test\n");
+    printf("==================\n\n");
+
+    thread_init();
+
+    int tids[NUM_THREADS];
+    int created = 0;
+
+    // Every other thread is a light thread with a small stack
+    thread_attr_t light;
+    thread_attr_init(&light);
+    thread_attr_setstacksize(&light, SMALL_STACK);
+
+    // Create all threads before joining any, so they are live at once
+    printf("Creating %d threads (chunk size %d, half with %d-byte stacks)...\n",
+           NUM_THREADS, THREADS_PER_CHUNK, SMALL_STACK);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (i % 2) {
+            tids[i] = thread_create_ex(&light, worker, (void*)(long)i);
+        } else {
+            tids[i] = thread_create(worker, (void*)(long)i);
+        }
+        if (tids[i] < 0) {
+            printf("thread_create failed at thread %d\n", i);
+            break;
+        }
+        created++;
+    }
+    printf("Created %d threads, table size now %d\n\n", created, thread_table_size);
+
+    // Join all threads and check their return values
+    int bad = 0;
+    for (int i = 0; i < created; i++) {
+        int retval = (int)(long)thread_join(tids[i]);
+        if (retval != i * 2) {
+            printf("Thread %d returned %d, expected %d\n", tids[i], retval, i * 2);
+            bad++;
+        }
+    }
+
+    printf("Threads finished: %d\n", finished);
+
+    // Create/join churn should reuse cached stacks and control blocks
+    // instead of growing the table
+    int table_before = thread_table_size;
+    for (int i = 0; i < CHURN_ROUNDS; i++) {
+        int tid = thread_create(worker, (void*)(long)i);
+        if ((int)(long)thread_join(tid) != i * 2) {
+            bad++;
+        }
+    }
+    printf("Churn: %d create/join rounds, table size %d -> %d\n",
+           CHURN_ROUNDS, table_before, thread_table_size);
+    if (thread_table_size != table_before) {
+        bad++;
+    }
+
+    if (created == NUM_THREADS && finished == NUM_THREADS + CHURN_ROUNDS && bad == 0) {
+        printf("SUCCESS! All threads ran and joined correctly.\n");
+    } else {
+        printf("FAILURE! Thread table did not scale as expected.\n");
+    }
+
+    exit();
+}
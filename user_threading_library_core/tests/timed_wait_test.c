@@ -0,0 +1,109 @@
+// Timed wait test - trylock/trywait fail at once when the lock or unit is
+// taken, and the timed variants give up after their ticks, leaving the
+// wait queue as they found it, or succeed if woken in time
+
+#include "../src/uthreads.h"
+
+#define TIMEOUT 10
+
+mutex_t lock;
+sem_t sem;
+cond_t cond;
+
+int failures = 0;
+
+void check(int ok, char *what) {
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Time a wait: returns its result, and sets *ticks to how long it took
+int timed_lock(int wait, int *ticks) {
+    int start = uptime();
+    int ret = mutex_timedlock(&lock, wait);
+    *ticks = uptime() - start;
+    return ret;
+}
+
+// Take the lock within a long timeout, then give it back
+void* patient_locker(void *arg) {
+    int ticks;
+    int ret = timed_lock(10 * TIMEOUT, &ticks);
+    if (ret == 0) {
+        mutex_unlock(&lock);
+    }
+    return (void*)(long)ret;
+}
+
+// Give up on the lock after TIMEOUT ticks
+void* impatient_locker(void *arg) {
+    int ticks;
+    int ret = timed_lock(TIMEOUT, &ticks);
+    if (ret == 0 || ticks < TIMEOUT) {
+        return (void*)1L;
+    }
+    return 0;
+}
+
+// Post the semaphore and signal the condition after a short sleep
+void* waker(void *arg) {
+    thread_sleep(TIMEOUT / 2);
+    sem_post(&sem);
+    mutex_lock(&lock);
+    cond_signal(&cond);
+    mutex_unlock(&lock);
+    return 0;
+}
+
+int main(void) {
+    printf("Timed Wait Test\n");
+    printf("===============\n\n");
+
+    thread_init();
+    mutex_init(&lock);
+    sem_init(&sem, 0);
+    cond_init(&cond);
+
+    // Test 1: trylock and timedlock against a lock main holds
+    mutex_lock(&lock);
+    int impatient = thread_create(impatient_locker, 0);
+    int patient = thread_create(patient_locker, 0);
+    int helper = thread_create(impatient_locker, 0);
+    check(thread_join(impatient) == 0, "mutex_timedlock times out");
+    check(thread_join(helper) == 0, "second mutex_timedlock times out");
+    mutex_unlock(&lock);
+    check(thread_join(patient) == 0, "mutex_timedlock succeeds after unlock");
+    check(lock.waiters.head == 0 && !lock.locked, "mutex left unlocked with no waiters");
+    check(mutex_trylock(&lock) == 0, "mutex_trylock on a free mutex");
+    int busy = thread_create(impatient_locker, 0);
+    check(thread_join(busy) == 0, "mutex_timedlock times out after trylock");
+    mutex_unlock(&lock);
+
+    // Test 2: sem_trywait and sem_timedwait
+    check(sem_trywait(&sem) == -1, "sem_trywait on an empty semaphore");
+    int start = uptime();
+    int ret = sem_timedwait(&sem, TIMEOUT);
+    check(ret == -1 && uptime() - start >= TIMEOUT, "sem_timedwait times out");
+    check(sem.count == 0 && sem.waiters.head == 0, "semaphore count restored");
+    int w = thread_create(waker, 0);
+    check(sem_timedwait(&sem, 10 * TIMEOUT) == 0, "sem_timedwait succeeds after post");
+
+    // Test 3: cond_timedwait, woken in time and not
+    mutex_lock(&lock);
+    check(cond_timedwait(&cond, &lock, 10 * TIMEOUT) == 0, "cond_timedwait signalled");
+    check(cond_timedwait(&cond, &lock, TIMEOUT) == -1, "cond_timedwait times out");
+    check(lock.owner_tid == thread_self() && cond.waiters.head == 0,
+          "mutex retaken after timeout");
+    mutex_unlock(&lock);
+    thread_join(w);
+
+    if (failures == 0) {
+        printf("SUCCESS! Try and timed waits behaved correctly.\n");
+    } else {
+        printf("FAILURE! %d timed wait checks failed.\n", failures);
+    }
+
+    exit();
+}
@@ -0,0 +1,91 @@
+// Thread-local storage test - each thread sees its own value for a key
+// across context switches, destructors run at exit, and deleted keys
+// come back empty
+
+#include "../src/uthreads.h"
+
+#define NUM_THREADS 5
+#define ROUNDS 20
+
+thread_key_t counter_key;
+thread_key_t name_key;
+
+// Values handed to the destructor, summed
+int destroyed = 0;
+int destructor_calls = 0;
+
+void count_destructor(void *value) {
+    destroyed += (int)(long)value;
+    destructor_calls++;
+}
+
+// Thread function: bump a per-thread counter kept in TLS, yielding in
+// between so the other threads do the same
+void* worker(void *arg) {
+    int id = (int)(long)arg;
+    int wrong = 0;
+
+    if (thread_getspecific(counter_key) != 0) {
+        wrong++;  // Must start out empty
+    }
+    thread_setspecific(name_key, arg);
+    for (int i = 0; i < ROUNDS; i++) {
+        long count = (long)thread_getspecific(counter_key);
+        thread_setspecific(counter_key, (void*)(count + id));
+        thread_yield();
+    }
+
+    if ((long)thread_getspecific(counter_key) != ROUNDS * id ||
+        thread_getspecific(name_key) != arg) {
+        wrong++;
+    }
+    return (void*)(long)wrong;
+}
+
+int main(void) {
+    printf("Thread-Local Storage Test\n");
+    printf("=========================\n\n");
+
+    thread_init();
+
+    thread_key_create(&counter_key, count_destructor);
+    thread_key_create(&name_key, 0);
+
+    // Test 1: per-thread values survive switches; destructors run at exit
+    thread_setspecific(counter_key, (void*)1000L);
+    int tids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        tids[i] = thread_create(worker, (void*)(long)(i + 1));
+    }
+    int wrong = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        wrong += (int)(long)thread_join(tids[i]);
+    }
+    if ((long)thread_getspecific(counter_key) != 1000) {
+        wrong++;  // main's value must be untouched
+    }
+
+    int expected = 0;
+    for (int i = 1; i <= NUM_THREADS; i++) {
+        expected += ROUNDS * i;
+    }
+    printf("Wrong values: %d\n", wrong);
+    printf("Destructor calls: %d, sum %d (expected %d, %d)\n",
+           destructor_calls, destroyed, NUM_THREADS, expected);
+
+    // Test 2: a deleted key is empty when it is handed out again
+    thread_key_delete(counter_key);
+    thread_key_t again;
+    thread_key_create(&again, 0);
+    int recycled_empty = (thread_getspecific(again) == 0);
+    printf("Recycled key starts empty: %s\n", recycled_empty ? "yes" : "no");
+
+    if (wrong == 0 && destructor_calls == NUM_THREADS && destroyed == expected &&
+        recycled_empty) {
+        printf("SUCCESS! Thread-local storage works.\n");
+    } else {
+        printf("FAILURE! Thread-local storage is broken.\n");
+    }
+
+    exit();
+}